@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "channels.h"
+#include "scheduler.h"
+
+// 160 MHz / (40 * 40) = 100 kHz sample rate, every bit of the stream lasts 10 usec
+#define BitstreamClockDiv 40
+#define BitstreamBitClockDiv 40
+#define BitstreamUsPerSample 10
+
+// Two buffers of 4096 samples (~41 msec): one is sent while the other one is rendered
+#define BitstreamBuffers 2
+#define BitstreamBufferWords 128
+#define BitstreamBufferSamples (BitstreamBufferWords * 32)
+
+/**
+ * Start the DMA stream of the given channel on the I2S data pin (GPIO3) at idle level.
+ */
+void setupBitstream(const DcfChannel &channel);
+
+/**
+ * Render the pulses of the bitstream channel (index) in the transmission into the stream.
+ * Called from the edge timer interrupt, the transmission stays valid until it is over.
+ */
+void bitstreamStart(const Transmission &transmission, uint8_t index);
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "protocol.h"
+
+// The bit clock of 160 MHz / (4 * 8) = 5 MHz holds exactly one carrier cycle per 1250 Hz in 4000 bits (125 words),
+// e.g. 62 cycles of DCF77 (77.5 kHz), 48 of MSF/WWVB/JJY60 (60 kHz) and 32 of JJY40 (40 kHz)
+#define CarrierClockDiv 4
+#define CarrierBitClockDiv 8
+#define CarrierBufferWords 125
+#define CarrierBufferCycles (Protocol::CarrierFrequency / 1250)
+
+static_assert(Protocol::CarrierFrequency % 1250 == 0, "the carrier frequency must be a multiple of 1250 Hz");
+
+// The buffer is split into descriptors of 160 usec, an amplitude change takes effect within this time
+#define CarrierDescriptors 5
+#define CarrierWordsPerDescriptor (CarrierBufferWords / CarrierDescriptors)
+
+/**
+ * Start to radiate the carrier of the protocol on the I2S data pin (GPIO3) at full amplitude.
+ */
+void setupCarrier();
+
+/**
+ * Switch between full and reduced amplitude, safe to be called from interrupt context.
+ */
+void carrierSetReduced(bool reduced);
+
+/**
+ * Render the full and reduced carrier patterns (CarrierBufferWords each, word n starts at carrier phase
+ * n * CarrierBufferCycles / CarrierBufferWords) and return one of them (also from interrupt context). The phase
+ * modulated carrier walks them too.
+ */
+void renderCarrierPatterns();
+const uint32_t *carrierPattern(bool reduced);
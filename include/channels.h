@@ -0,0 +1,133 @@
+#pragma once
+
+#include <Arduino.h>
+#include "time.h"
+
+#include "protocol.h"
+#include "variant.h"
+
+// How many output channels can be driven at most
+#define MaxChannels 4
+
+// Default pin of the first channel, see variant.h
+#define DCF_OUT_PIN Variant::OutputPin
+
+// Upper bounds of the burst layout, they size the frame storage of a transmission
+// (build flag -D MaxBurstMinutes=10 for longer bursts)
+#ifndef MaxBurstMinutes
+#define MaxBurstMinutes 5
+#endif
+#define MaxHeadPulses 10
+#define MaxTailPulses 10
+#define MaxPulseNumber (MaxHeadPulses + MaxBurstMinutes * MaxFrameSeconds + MaxTailPulses)
+
+// Least idle time between two transmissions, the edge offsets of the channels (+/- 1 sec) must not overlap
+#define MinBurstGapSeconds 2
+
+// Largest edge offset of a channel, one second in both directions
+#define MaxEdgeOffsetUs 999999L
+
+enum OutputMode : uint8_t
+{
+  PushPull,
+  OpenDrain, // Only pulls low, the high level comes from the pull-up of the clock
+};
+
+/**
+ * One DCF77 output: a GPIO with its own time zone, time correction offset and polarity.
+ * All channels share the same timebase and are written together by the edge scheduler.
+ */
+struct DcfChannel
+{
+  uint8_t pin;
+  // false: idle high with active low pulses, true: idle low with active high pulses
+  bool inverted;
+  OutputMode mode;
+  OutputBackend backend;
+  char timezone[40];        // https://github.com/nayarsystems/posix_tz_db/blob/master/zones.csv
+  int timeCorrectionOffset; // Define a time correction offset in seconds
+  // Shift of all edges in microseconds, negative values let the pulses lead to compensate the receiver latency
+  int32_t edgeOffsetUs;
+};
+
+/**
+ * Layout of every transmission: BurstMinutes complete frames, preceded by the last head pulses of the minute
+ * before (to allow some clock model synchronization of the beginning frame) and followed by the first tail pulses
+ * of the next minute (the following marker to safely close the frame), then an idle gap.
+ */
+struct BurstConfig
+{
+  uint8_t minutes;     // 1..MaxBurstMinutes
+  uint8_t headPulses;  // 0..MaxHeadPulses
+  uint8_t tailPulses;  // 0..MaxTailPulses
+  uint16_t gapSeconds; // from the end of a transmission to the first head pulse of the next one
+};
+
+extern DcfChannel channels[MaxChannels];
+extern uint8_t channelCount;
+extern BurstConfig burstConfig;
+
+/**
+ * Set the burst layout, every value is clamped to its bounds.
+ */
+void setBurstConfig(long minutes, long headPulses, long tailPulses, long gapSeconds);
+
+/**
+ * Number of pulses (seconds) of a transmission with the given layout and the first frame starting at firstFrame
+ * (one more for every minute with a leap second).
+ */
+uint16_t burstPulseCount(const BurstConfig &burst, time_t firstFrame);
+
+/**
+ * Only GPIO0..15 can be written through the shared output register, GPIO16 lives in the RTC block.
+ */
+bool isValidChannelPin(int pin);
+
+/**
+ * Add another channel, returns nullptr if all channel slots are in use or the pin is not usable.
+ */
+DcfChannel *addChannel(uint8_t pin, const char *timezone, int timeCorrectionOffset, bool inverted);
+
+/**
+ * Select the output backend of a channel. The I2S based backends (carrier and bitstream) need the I2S data pin,
+ * so only one channel can use them; returns false if another channel already does, the firmware variant does not
+ * have the backend or the protocol has no phase modulation for the phase carrier.
+ */
+bool setChannelBackend(DcfChannel &channel, OutputBackend backend);
+
+/**
+ * Output backend by its config name ("gpio", "carrier", "bitstream" or "carrier-pm") and back.
+ */
+OutputBackend backendFromName(const char *name);
+const char *backendName(OutputBackend backend);
+
+/**
+ * Clamp an edge offset to +/- MaxEdgeOffsetUs.
+ */
+int32_t validEdgeOffset(long edgeOffsetUs);
+
+/**
+ * Describe the minute starting at frameStart in the time zone of the given channel
+ * (including its time correction offset).
+ */
+void channelFrameTime(const DcfChannel &channel, time_t frameStart, FrameTime *frame);
+
+/**
+ * Encode the minute starting at frameStart (UTC) for the given channel, without payload bits
+ * (frameSeconds() symbols).
+ */
+void encodeChannelFrame(const DcfChannel &channel, time_t frameStart, uint8_t *symbols);
+
+/**
+ * Forget the last frame of every channel, the next one is encoded in full (after a change the incremental update
+ * does not see, e.g. a new leap second).
+ */
+void resetFrameEncoder();
+
+/**
+ * Encode the complete pulses of a channel for one transmission (burstPulseCount() symbols of the protocol, one per
+ * second, DCF77: 0 = no pulse, 1=100msec, 2=200msec): the head pulses, the frames of the burst with the first one
+ * starting at firstFrame (UTC, a full minute) and the tail pulses. Frames are taken from the lookahead cache when
+ * they are ready there.
+ */
+void calculateArray(const DcfChannel &channel, time_t firstFrame, const BurstConfig &burst, uint8_t *pulses);
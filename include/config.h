@@ -0,0 +1,96 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "channels.h"
+#include "ntp_client.h"
+
+#define HOSTNAME "ESP-DCF77"
+
+// The settings, written to the temporary file first and renamed over the old one when complete
+#define CONFIG_FILE "/config.json"
+#define CONFIG_TEMP_FILE "/config.json.tmp"
+
+// Changed settings are written this long after the last change (a series of changes gives one flash write), but
+// at most this long after the first one
+#define ConfigWriteDelayMs 5000UL
+#define ConfigWriteMaxDelayMs 30000UL
+
+extern char ntpServer[40];
+
+// OTA settings
+extern unsigned int otaPort;
+extern char otaPassword[32]; // Set OTA password via WiFi manager!
+
+// Flag for saving data
+extern bool shouldSaveConfig;
+
+/**
+ * Mount the file system and load CONFIG_FILE into the global settings and output channels.
+ */
+void prepareFileSystem();
+
+/**
+ * The global settings and output channels were changed, serviceConfig() writes them back to CONFIG_FILE once no
+ * further change follows.
+ */
+void saveConfig();
+
+/**
+ * Write pending changes now (before a deep sleep or a restart).
+ */
+void flushConfig();
+
+/**
+ * Write the pending changes after ConfigWriteDelayMs.
+ */
+void serviceConfig();
+
+/**
+ * What a change of the settings touched, the callback redoes what depends on it.
+ */
+enum ConfigChange : uint8_t
+{
+  ConfigTimezone = 1,   // system time zone and encoded frames
+  ConfigNtpServers = 2, // server list of the NTP client
+  ConfigFrames = 4,     // encoded frames (time correction offset)
+  ConfigOta = 8,        // OTA port and password
+  ConfigOther = 16,     // only to be saved (burst layout, edge offset)
+};
+
+typedef void (*ConfigChangedCallback)(uint8_t changes);
+
+/**
+ * The settings which can be changed while running (PUT /config, config portal), restored as a whole if any new
+ * value is rejected.
+ */
+struct ConfigSnapshot
+{
+  char ntpServer[40];
+  char ntpServers[NtpMaxServers - 1][40];
+  char timezone[40];
+  int timeCorrectionOffset;
+  int32_t edgeOffsetUs;
+  BurstConfig burst;
+  char otaPassword[32];
+  unsigned int otaPort;
+};
+
+void takeConfigSnapshot(ConfigSnapshot &snapshot);
+void restoreConfigSnapshot(const ConfigSnapshot &snapshot);
+
+/**
+ * ConfigChange bits of the settings which differ from the snapshot.
+ */
+uint8_t configChanges(const ConfigSnapshot &before);
+
+/**
+ * Called with the ConfigChange bits after the settings were changed while running.
+ */
+void setConfigChangedCallback(ConfigChangedCallback callback);
+void notifyConfigChanged(uint8_t changes);
+
+/**
+ * Register PUT /config: the JSON object changes the given settings live, either all of them or none.
+ */
+void setupConfigService();
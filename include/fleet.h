@@ -0,0 +1,53 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "fleet_packet.h"
+#include "sntp_packet.h"
+
+// Multicast group and port of the fleet packets
+#define FleetGroup 239, 255, 77, 77
+#define FleetPort 7777
+
+// The master sends a packet this often, followers keep the largest clock offset of the last FleetOffsetWindow
+// packets (the one delayed least on its way) and step their clock if it is off by more than FleetMaxOffsetUs
+#define FleetIntervalMs 10000
+#define FleetOffsetWindow 6
+#define FleetMaxOffsetUs 1000
+
+enum FleetRole : uint8_t
+{
+  FleetOff,
+  FleetMaster,   // Synced by NTP, multicasts its frames and wall clock
+  FleetFollower, // No NTP, takes the time and the frames from the master
+};
+
+extern FleetRole fleetRole;
+
+/**
+ * Role by its config name ("off", "master" or "follower") and back.
+ */
+FleetRole fleetRoleFromName(const char *name);
+const char *fleetRoleName(FleetRole role);
+
+/**
+ * Follower: the frames of the channel come from the master (same time zone and offset as its first channel), the
+ * frame cache does not encode them.
+ */
+bool fleetFeedsChannel(uint8_t channel);
+
+/**
+ * Follower: the master its clock follows, as upstream server of the SNTP answers. False before the first packet
+ * and while the master is not synchronized itself.
+ */
+bool fleetUpstream(SntpUpstream &upstream);
+
+/**
+ * Call when the system time was set (by NTP on the master).
+ */
+void fleetTimeSynced();
+
+/**
+ * Master: send the packet when it is due. Follower: join the group and take in the received packets.
+ */
+void serviceFleet();
@@ -0,0 +1,78 @@
+#pragma once
+
+// Only standard headers: the packet format is shared with host tools and host-native test instances
+#include <stdint.h>
+#include <stddef.h>
+
+#define FleetMagic "DCFf"
+#define FleetVersion 3
+
+// Frames per packet: the current minute and the following ones, enough for a whole transmission
+#define FleetFrames 8
+#define FleetMaxFrameSeconds 61
+#define FleetNameLength 6
+#define FleetTimezoneLength 39
+
+// Largest encoded packet
+#define FleetHeaderBytes (4 + 1 + FleetNameLength + 4 + 4 + 8 + FleetTimezoneLength + 4 + 1 + 1)
+#define FleetFrameHeaderBytes (8 + 1)
+#define FleetPacketBytes (FleetHeaderBytes + FleetFrames * (FleetFrameHeaderBytes + (FleetMaxFrameSeconds + 1) / 2))
+
+struct FleetFrame
+{
+  int64_t minute;  // UTC time of the minute marker
+  uint8_t seconds; // symbols in the frame
+  uint8_t symbols[FleetMaxFrameSeconds];
+};
+
+/**
+ * One multicast packet of the master: its wall clock when sending and the frames of the coming minutes
+ * (of its first channel, including the payload bits, with the time zone and offset they were encoded for).
+ */
+struct FleetPacket
+{
+  char protocol[FleetNameLength + 1]; // Protocol::Name, together with the carrier frequency
+  uint32_t carrierFrequency;
+  uint32_t sequence;
+  int64_t sentEpochUs; // microseconds since the epoch
+  char timezone[FleetTimezoneLength + 1];
+  int32_t timeCorrectionOffset;
+  uint8_t stratum; // of the master as SNTP server, 16: unsynchronized
+  uint8_t frameCount;
+  FleetFrame frames[FleetFrames];
+};
+
+/**
+ * What a follower keeps of the last packet it took.
+ */
+struct FleetFollowerState
+{
+  bool taken;
+  uint32_t sequence;
+  int64_t sentEpochUs;
+};
+
+enum FleetAcceptance : uint8_t
+{
+  FleetAccepted,
+  FleetForeign, // another protocol or carrier
+  FleetStale,   // a duplicate or one overtaken by a later packet
+};
+
+/**
+ * Serialize a packet (little endian, two symbols per byte), returns its length or 0 if the buffer is too small.
+ */
+size_t encodeFleetPacket(const FleetPacket &packet, uint8_t *buffer, size_t size);
+
+/**
+ * Parse a received packet, false if it is malformed or of another version.
+ */
+bool decodeFleetPacket(const uint8_t *buffer, size_t length, FleetPacket *packet);
+
+/**
+ * Check a decoded packet against the protocol of the follower and the last packet it took (updated if accepted).
+ * A packet is stale if neither its sequence nor its send time is later than the last one's; a restarted master
+ * starts its sequence over but sends later.
+ */
+FleetAcceptance acceptFleetPacket(const FleetPacket &packet, const char *protocol, uint32_t carrierFrequency,
+                                  FleetFollowerState &state);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+#include "time.h"
+
+#include "channels.h"
+
+// How many minutes ahead every channel keeps encoded frames (build flag -D FRAME_CACHE_MINUTES=60),
+// a transmission needs the current minute (head pulses), up to MaxBurstMinutes frames and the tail minute
+#ifndef FRAME_CACHE_MINUTES
+#define FRAME_CACHE_MINUTES 15
+#endif
+
+static_assert(FRAME_CACHE_MINUTES >= MaxBurstMinutes + 2, "the frame cache must hold a whole transmission");
+
+// Earlier wall clock times are taken as "not synchronized yet"
+#define MinValidTime 1600000000
+
+// A time update moving the wall clock by more than this is a step, smaller ones are SNTP fine adjustments
+#define ClockStepSeconds 2
+
+/**
+ * Encode at most one missing frame of the lookahead window, call it from the main loop whenever there is time.
+ */
+void serviceFrameCache();
+
+/**
+ * Copy the encoded frame of the minute starting at frameStart (UTC) if it is cached, without payload bits.
+ */
+bool readCachedFrame(const DcfChannel &channel, time_t frameStart, uint8_t *symbols);
+
+/**
+ * Put a frame encoded elsewhere (e.g. received from the fleet master) into the cache.
+ */
+void storeCachedFrame(const DcfChannel &channel, time_t frameStart, const uint8_t *symbols);
+
+/**
+ * Drop all cached frames and the state of the incremental encoder, e.g. after the clock was stepped, the channel
+ * config or the leap second table changed.
+ */
+void invalidateFrameCache();
+
+/**
+ * Call whenever the system time was set, invalidates the cache if the clock was stepped.
+ */
+void frameCacheTimeSet();
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <Arduino.h>
+
+// The I2S data output of the ESP8266 is fixed to GPIO3 (RX0)
+#define I2S_DATA_PIN 3
+
+// Base clock of the I2S block, the bit clock is I2S_BASE_CLOCK / (clockDiv * bitClockDiv)
+#define I2S_BASE_CLOCK 160000000UL
+
+/**
+ * SLC DMA descriptor, the layout is given by the hardware.
+ */
+struct I2sDmaDescriptor
+{
+  uint32_t blocksize : 12;
+  uint32_t datalen : 12;
+  uint32_t unused : 5;
+  uint32_t sub_sof : 1;
+  uint32_t eof : 1;
+  volatile uint32_t owner : 1;
+  uint32_t *buf_ptr;
+  I2sDmaDescriptor *next_link_ptr;
+};
+
+typedef void (*I2sDmaBufferDone)(I2sDmaDescriptor *descriptor);
+
+/**
+ * Link count descriptors to a closed ring, descriptor n points to buffer + n * wordsPerDescriptor.
+ * An end-of-frame interrupt is requested for every descriptor if withInterrupt is set.
+ */
+void i2sDmaInitRing(I2sDmaDescriptor *ring, uint8_t count, uint32_t *buffer, uint16_t wordsPerDescriptor, bool withInterrupt);
+
+/**
+ * Start to stream the descriptor ring to the I2S data pin. The DMA loops over the ring without any CPU
+ * involvement, bufferDone (if any) is called from interrupt context whenever a descriptor has been sent.
+ */
+void i2sDmaBegin(I2sDmaDescriptor *ring, uint8_t clockDiv, uint8_t bitClockDiv, I2sDmaBufferDone bufferDone);
+
+void i2sDmaEnd();
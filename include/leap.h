@@ -0,0 +1,72 @@
+#pragma once
+
+#include <Arduino.h>
+#include "time.h"
+
+// Leap second table in the IERS / IETF format (lines "<NTP seconds> <TAI-UTC>", comments start with #)
+#define LEAP_SECONDS_FILE "/leap-seconds.list"
+
+// Leap seconds kept from the table (only the latest ones can still be ahead)
+#define LeapTableSize 4
+
+// DCF77 announces a leap second (bit 19) during the hour before it
+#define LeapAnnounceSeconds 3600
+
+/**
+ * Read LEAP_SECONDS_FILE, if there is one.
+ */
+void loadLeapSeconds();
+
+/**
+ * Insert a leap second before the UTC time end (a full day, the first second after the 61 second minute). A new
+ * one invalidates the frame cache.
+ */
+void addLeapSecond(time_t end);
+
+/**
+ * Take the leap indicator of the selected NTP server (1: a leap second is inserted at the end of the month).
+ */
+void ntpLeapIndicator(uint8_t leapIndicator, time_t now);
+
+/**
+ * End of the next known leap second after now, 0 if there is none.
+ */
+time_t nextLeapSecond(time_t now);
+
+/**
+ * The UTC minute starting at minuteStart has 61 seconds.
+ */
+bool leapSecondMinute(time_t minuteStart);
+
+/**
+ * A leap second follows within LeapAnnounceSeconds after minuteStart.
+ */
+bool leapSecondAnnounced(time_t minuteStart);
+
+/**
+ * A leap second is inserted at the end of the UTC month of minuteStart.
+ */
+bool leapSecondThisMonth(time_t minuteStart);
+
+/**
+ * Seconds (symbols) of the frame of the minute starting at minuteStart.
+ */
+uint8_t frameSeconds(time_t minuteStart);
+
+/**
+ * Seconds to add to the wall clock time t for the micros64() timeline: leap seconds ahead of the clock, not yet
+ * taken out of it.
+ */
+uint8_t leapSecondsBefore(time_t t);
+
+/**
+ * Step the clock back by the leap second when it passes (the NTP servers do the same, the next poll finds no
+ * offset then).
+ */
+void serviceLeapSeconds();
+
+/**
+ * True (once) if the last time set was the step of serviceLeapSeconds(), which must not count as a sync. Asked by
+ * the settimeofday() callback, which the core may call only after loop() returned.
+ */
+bool takeLeapSecondStep();
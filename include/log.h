@@ -0,0 +1,137 @@
+#pragma once
+
+#include <Arduino.h>
+#include <type_traits>
+
+#include "config.h"
+
+// Log levels, records above LOG_LEVEL are removed at compile time (their arguments are not even evaluated)
+#define LogLevelNone 0
+#define LogLevelError 1
+#define LogLevelWarn 2
+#define LogLevelInfo 3
+#define LogLevelDebug 4
+
+#ifndef LOG_LEVEL
+#ifdef DEBUG
+#define LOG_LEVEL LogLevelDebug
+#else
+#define LOG_LEVEL LogLevelWarn
+#endif
+#endif
+
+// Records waiting to be written (a power of two) and their arguments
+#define LogRecords 64
+#define LogMaxArgs 6
+// Copies of the string arguments of a record, together; the rest is cut off
+#define LogTextBytes 32
+// Longest formatted line, the rest is cut off (fits the 128 byte UART FIFO)
+#define LogLineLength 120
+// Formatted lines kept for GET /log
+#define LogTailBytes 2048
+// Records formatted per serviceLog() call
+#define LogDrainRecords 4
+
+#define SyslogPort 514
+#define SyslogFacility 16 // local0
+#define SyslogResolveRetryMs 60000
+
+// Host name or address of the syslog server, empty: no syslog
+extern char syslogServer[40];
+
+/**
+ * One log call: the format string stays in flash and the arguments are stored as they are, string arguments are
+ * copied into text (a buffer they point to may change before the line is formatted at idle time).
+ */
+struct LogRecord
+{
+  uint32_t millis;
+  PGM_P format;
+  uint32_t args[LogMaxArgs]; // string arguments: offset of the copy in text
+  char text[LogTextBytes];
+  uint8_t strings;           // bit n set: argument n is a string
+  uint8_t level;
+};
+
+/**
+ * Append a record to the ring, from any context (also interrupts). Dropped and counted while the ring is full.
+ * The arguments flagged in strings point to strings in RAM, they are copied.
+ */
+void logPush(uint8_t level, PGM_P format, const uint32_t *args, uint8_t count, uint8_t strings);
+
+template <typename T>
+inline __attribute__((always_inline)) uint32_t logArg(T value)
+{
+  static_assert(std::is_integral<T>::value || std::is_enum<T>::value || std::is_pointer<T>::value,
+                "log arguments are integers, pointers and strings (char *, copied)");
+  static_assert(sizeof(T) <= sizeof(uint32_t), "log arguments are 32 bit at most");
+  return (uint32_t)(uintptr_t)value;
+}
+
+template <typename T>
+constexpr bool logIsString()
+{
+  return std::is_pointer<T>::value &&
+         std::is_same<typename std::remove_cv<typename std::remove_pointer<T>::type>::type, char>::value;
+}
+
+// Bit n set if argument n is a string
+template <typename... Args>
+constexpr uint8_t logStrings()
+{
+  uint8_t strings = 0;
+  uint8_t bit = 1;
+
+  ((strings |= logIsString<Args>() ? bit : 0, bit <<= 1), ...);
+  return strings;
+}
+
+template <typename... Args>
+inline __attribute__((always_inline)) void logWrite(uint8_t level, PGM_P format, Args... args)
+{
+  static_assert(sizeof...(Args) <= LogMaxArgs, "too many log arguments");
+  const uint32_t values[sizeof...(Args) + 1] = {logArg(args)...};
+
+  logPush(level, format, values, sizeof...(Args), logStrings<Args...>());
+}
+
+// printf style logging, the format must be a string literal
+#if LOG_LEVEL >= LogLevelError
+#define logError(format, ...) logWrite(LogLevelError, PSTR(format), ##__VA_ARGS__)
+#else
+#define logError(format, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LogLevelWarn
+#define logWarn(format, ...) logWrite(LogLevelWarn, PSTR(format), ##__VA_ARGS__)
+#else
+#define logWarn(format, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LogLevelInfo
+#define logInfo(format, ...) logWrite(LogLevelInfo, PSTR(format), ##__VA_ARGS__)
+#else
+#define logInfo(format, ...) ((void)0)
+#endif
+
+#if LOG_LEVEL >= LogLevelDebug
+#define logDebug(format, ...) logWrite(LogLevelDebug, PSTR(format), ##__VA_ARGS__)
+#else
+#define logDebug(format, ...) ((void)0)
+#endif
+
+/**
+ * Start the serial port and register GET /log (the last lines).
+ */
+void setupLog();
+
+/**
+ * Idle time: format a few records and write them to the serial port (only as much as the UART FIFO takes without
+ * waiting), the syslog server and the tail for GET /log.
+ */
+void serviceLog();
+
+/**
+ * Write out all records, waiting for the serial port (before a reset or deep sleep).
+ */
+void flushLog();
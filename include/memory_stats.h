@@ -0,0 +1,62 @@
+#pragma once
+
+#include <Arduino.h>
+
+// The memory figures are logged this often
+#define MemoryLogIntervalMs 600000UL
+
+// The SYS stack (interrupts and SDK callbacks) ends at the top of the data RAM
+#define SysStackTop 0x40000000UL
+
+/**
+ * Subsystems the heap allocations are attributed to, see HeapScope.
+ */
+enum HeapOwner : uint8_t
+{
+  HeapOther,
+  HeapWifi,   // WiFiManager and its portal
+  HeapWeb,    // HTTP requests
+  HeapConfig, // config.json
+  HeapNtp,    // NTP client
+  HeapLog,    // syslog
+  HeapFleet,  // fleet packets
+  HeapOwners,
+};
+
+/**
+ * Attributes the allocations made while it exists to a subsystem, and the heap the subsystem kept (the change of
+ * the free heap from construction to destruction, nested scopes included).
+ */
+struct HeapScope
+{
+  explicit HeapScope(HeapOwner owner);
+  ~HeapScope();
+
+  HeapOwner previous;
+  uint32_t freeHeap;
+};
+
+// Lowest stack pointer seen by the edge timer interrupt
+extern uint32_t interruptStackLow;
+
+/**
+ * Sample the stack depth, called at the start of the edge timer interrupt.
+ */
+static inline __attribute__((always_inline)) void sampleInterruptStack()
+{
+  uint32_t sp;
+
+  asm volatile("mov %0, a1" : "=r"(sp));
+  if (sp < interruptStackLow)
+    interruptStackLow = sp;
+}
+
+/**
+ * Register GET /status (heap, fragmentation, stack high water marks and the heap use of every subsystem).
+ */
+void setupMemoryStats();
+
+/**
+ * Track the lowest free heap and log the figures every MemoryLogIntervalMs.
+ */
+void serviceMemoryStats();
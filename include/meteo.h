@@ -0,0 +1,32 @@
+#pragma once
+
+#include <Arduino.h>
+#include "time.h"
+
+// How many minutes of payload can be queued (one Meteotime block covers three minutes)
+#define MeteoQueueMinutes 60
+
+// Payload file on LittleFS, one block per line: "<UTC epoch of the first minute> <bits>"
+#define METEO_FILE "/meteo.txt"
+
+/**
+ * Queue payload bits (a string of '0' and '1', Protocol::PayloadBits per minute) for consecutive minutes
+ * starting at firstMinute (UTC). Returns the number of minutes queued, 0 if the bits are invalid.
+ */
+int queueMeteoBits(time_t firstMinute, const char *bits);
+
+/**
+ * Parse and queue payload lines ("<UTC epoch> <bits>", one per line), returns the number of minutes queued.
+ */
+int queueMeteoLines(const char *text);
+
+/**
+ * Insert the queued payload of the frame starting at frameStart (UTC) into its symbols,
+ * the rest of the frame stays untouched.
+ */
+void applyMeteoBits(uint8_t *symbols, time_t frameStart);
+
+/**
+ * Load METEO_FILE and register the HTTP POST /meteo handler.
+ */
+void setupMeteo();
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "ntp_select.h"
+#include "ntp_discipline.h"
+#include "sntp_packet.h"
+
+// Servers queried in parallel: ntpServer and the "ntpServers" of the config ("host" or "host:port")
+#define NtpMaxServers 4
+#define NtpPort 123
+#define NtpLocalPort 50123
+
+// After a start a burst of polls fills the clock filters quickly (a peer is selectable from its fourth sample on),
+// then the interval is adapted, see ntp_discipline.h
+#define NtpBurstPolls 6
+#define NtpBurstIntervalMs 2000
+// Answers later than this are dropped
+#define NtpResponseTimeoutMs 1000
+// A failed name lookup is retried after this long
+#define NtpResolveRetryMs 60000
+
+typedef void (*NtpSyncCallback)();
+
+// Further servers besides ntpServer, "host" or "host:port" (e.g. fake servers on a test host)
+extern char ntpServers[NtpMaxServers - 1][40];
+
+/**
+ * Take the server list from ntpServer and ntpServers (again after they were changed), a single pool name is
+ * expanded to its numbered pools.
+ */
+void loadNtpServers();
+
+/**
+ * Load the server list and register GET /ntp (statistics of every server).
+ */
+void setupNtpClient();
+
+/**
+ * Poll all servers now (e.g. after the radio was switched on).
+ */
+void requestNtpPoll();
+
+/**
+ * The system peer the clock was last set from, false before the first update with a majority of the servers.
+ */
+bool ntpUpstream(SntpUpstream &upstream);
+
+/**
+ * Called after an update which slewed the clock or left it alone; a step calls the settimeofday() callback.
+ */
+void setNtpSyncCallback(NtpSyncCallback callback);
+
+/**
+ * True (once) if the last time set was a slew step of the NTP client, which must not count as a sync. Asked by the
+ * settimeofday() callback like takeLeapSecondStep().
+ */
+bool takeNtpSlewStep();
+
+/**
+ * Send the polls when due (the server names are resolved in the background), take in the answers, correct the
+ * clock by the combined offset once all are in, and go on with a slew.
+ */
+void serviceNtpClient();
@@ -0,0 +1,62 @@
+#pragma once
+
+// Only standard headers: the poll interval and the corrections are tested on the host like the selection
+#include <stdint.h>
+
+// Poll interval 2^exponent seconds (16 s .. 1024 s), adapted to the measured drift and jitter
+#define NtpMinPollExponent 4
+#define NtpMaxPollExponent 10
+
+// Error allowed at the second edges: the interval is lengthened while the drift over the next one plus the jitter
+// stays below half of it (NtpPollHysteresis times in a row) and shortened as soon as an offset exceeds it
+#define NtpErrorBudgetUs 2000
+#define NtpPollHysteresis 4
+// A larger offset is a step, polling starts over at the shortest interval
+#define NtpStepOffsetUs 128000
+// A smaller one is slewed at the rate of RFC 5905, in steps small against the error budget
+#define NtpSlewRatePpm 500
+#define NtpSlewStepUs 250
+// An offset within the jitter of the servers is noise and left alone, up to this
+#define NtpMaxIgnoredOffsetUs (NtpErrorBudgetUs / 8)
+// Drift estimate: running average over this many updates, limited to the frequency tolerance of RFC 5905
+#define NtpFrequencyAverage 4
+#define NtpMaxFrequencyPpm 500
+
+enum NtpCorrection : uint8_t
+{
+  NtpIgnore,
+  NtpSlew,
+  NtpStep,
+};
+
+/**
+ * State of the clock discipline between the updates.
+ */
+struct NtpDiscipline
+{
+  bool synced;           // the clock was stepped to the servers once
+  uint8_t pollExponent;
+  uint8_t jiggle;        // updates in a row which allow a longer interval
+  float frequencyPpm;    // drift of the local clock
+  uint64_t lastUpdateUs; // local monotonic time (micros64()) of the last update
+  int64_t slewUs;        // part of the last offset not corrected yet
+  bool slewing;          // false: that part is ignored
+};
+
+/**
+ * Start over: shortest interval, no drift estimate, the next update steps the clock.
+ */
+void clearNtpDiscipline(NtpDiscipline &discipline);
+
+/**
+ * Take the combined offset of an update: step the clock on the first update and above NtpStepOffsetUs, ignore
+ * an offset within the jitter, otherwise slew it. The drift grown since the last update (the offset less what was
+ * left uncorrected then) and the jitter adapt the poll interval.
+ */
+NtpCorrection updateNtpDiscipline(NtpDiscipline &discipline, int64_t offsetUs, int64_t jitterUs, uint64_t nowUs);
+
+/**
+ * The next part of the slew, elapsedUs after the last one: 0 until NtpSlewRatePpm allows a whole step (or the
+ * rest), then at most NtpSlewStepUs. Taken off the slew.
+ */
+int64_t nextNtpSlewStep(NtpDiscipline &discipline, uint64_t elapsedUs);
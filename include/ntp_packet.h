@@ -0,0 +1,45 @@
+#pragma once
+
+// Only standard headers: requests and answers are checked on the host against fake servers
+#include <stdint.h>
+#include <stddef.h>
+
+#include "ntp_select.h"
+
+#define NtpPacketBytes 48
+
+/**
+ * What the client keeps of a request until the answer: the transmit timestamp as sent, which the server echoes as
+ * originate timestamp, and the local clock at sending (T1).
+ */
+struct NtpRequest
+{
+  uint8_t cookie[8];
+  int64_t sentUs;
+};
+
+/**
+ * An accepted answer: the sample and what the server tells about itself.
+ */
+struct NtpAnswer
+{
+  NtpSample sample;
+  uint8_t stratum;
+  uint8_t leap;
+  int64_t rootDelayUs;
+  int64_t rootDispersionUs;
+};
+
+/**
+ * Client request (mode 3, version 4) with the local clock sentUs as transmit timestamp.
+ */
+void buildNtpRequest(uint8_t *packet, int64_t sentUs, NtpRequest &request);
+
+/**
+ * Check an answer against its request: a server answer (mode 4) of a synchronized server (leap indicator not 3,
+ * stratum 1..15) echoing the request, with a transmit timestamp. Offset, delay and dispersion of the sample come
+ * from T1..T4 as in RFC 5905 8, receivedUs is the local clock (T4) and nowUs the local monotonic time when it was
+ * received. False if the answer is rejected.
+ */
+bool parseNtpAnswer(const uint8_t *packet, size_t length, const NtpRequest &request, int64_t receivedUs,
+                    uint64_t nowUs, NtpAnswer &answer);
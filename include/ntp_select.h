@@ -0,0 +1,81 @@
+#pragma once
+
+// Only standard headers: the filter and selection run on the host against fake servers as well
+#include <stdint.h>
+
+// RFC 5905 constants
+#define NtpFilterStages 8           // NSTAGE, samples in the clock filter of every peer
+#define NtpMaxDispersionUs 16000000 // MAXDISP
+#define NtpMinDispersionUs 5000     // MINDISP
+#define NtpMaxDistanceUs 1500000    // MAXDIST, peers with a larger root distance are not selected
+#define NtpMinClusterSurvivors 3    // NMIN
+#define NtpPhiPpm 15                // PHI, frequency tolerance
+
+// Seconds from 1900 (NTP era 0) to 1970
+#define NtpUnixOffset 2208988800UL
+
+struct NtpSample
+{
+  int64_t offsetUs;     // theta: server clock minus local clock
+  int64_t delayUs;      // delta: round trip delay
+  int64_t dispersionUs; // epsilon: at the time it was taken
+  uint64_t timeUs;      // local monotonic time (micros64()) it was taken
+  bool valid;
+};
+
+/**
+ * One server as seen through the clock filter.
+ */
+struct NtpPeer
+{
+  NtpSample samples[NtpFilterStages]; // shift register, newest first
+  int64_t offsetUs;                   // of the sample with the least delay
+  int64_t delayUs;
+  int64_t dispersionUs;
+  int64_t jitterUs;
+  uint64_t updateUs;      // local monotonic time of the selected sample
+  int64_t rootDelayUs;    // of the server, from its last answer
+  int64_t rootDispersionUs;
+  uint8_t stratum;
+  uint8_t leap;           // leap indicator of the last answer
+  bool valid;             // at least one sample
+};
+
+/**
+ * Reset a peer (no samples).
+ */
+void clearNtpPeer(NtpPeer &peer);
+
+/**
+ * Shift a new sample into the clock filter and update offset, delay, dispersion and jitter of the peer from
+ * the sample with the least delay.
+ */
+void addNtpSample(NtpPeer &peer, const NtpSample &sample, uint64_t nowUs);
+
+/**
+ * Shift all samples of the peer after the local clock was stepped by stepUs.
+ */
+void shiftNtpPeer(NtpPeer &peer, int64_t stepUs);
+
+/**
+ * Root synchronization distance of a peer (lambda), the error bound of its offset.
+ */
+int64_t ntpRootDistance(const NtpPeer &peer, uint64_t nowUs);
+
+/**
+ * Result of the selection: the truechimers surviving the intersection and cluster algorithms, the system peer
+ * (least root distance of the survivors) and the combined offset.
+ */
+struct NtpSelection
+{
+  bool survivors[16];
+  int8_t systemPeer; // -1: no majority of the peers agrees
+  uint8_t survivorCount;
+  int64_t offsetUs;
+  int64_t jitterUs;
+};
+
+/**
+ * Intersection (Marzullo), cluster and combine algorithms of RFC 5905 over up to 16 peers.
+ */
+bool selectNtpPeers(const NtpPeer *peers, uint8_t count, uint64_t nowUs, NtpSelection *selection);
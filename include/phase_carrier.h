@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "carrier.h"
+#include "channels.h"
+#include "scheduler.h"
+
+// DCF77 phase modulation: 512 pseudo random chips of 120 carrier cycles (~1.55 msec) each, starting 200 msec
+// into the second. A 1 data bit sends the inverted sequence.
+#define PrnChips 512
+#define PrnChipCycles 120
+#define PrnStartMs 200
+
+// Phase deviation of a chip in steps of 1/CarrierBufferWords carrier cycle (2.88 degrees),
+// 5 steps = +/- 14.4 degrees, the closest step to the +/- 15.6 degrees of DCF77
+#define PrnPhaseSteps 5
+
+// Bits of the 5 MHz stream per second and per chip (120 cycles * 4000 bits / 62 cycles = 7741.9 bits)
+#define PhaseCarrierBitsPerSecond 5000000UL
+#define PhaseCarrierChipBits(chips) ((uint32_t)(chips) * PrnChipCycles * CarrierBufferWords * 32 / CarrierBufferCycles)
+
+// Two buffers of 400 words (2.56 msec): one is sent while the other one is rendered
+#define PhaseCarrierBuffers 2
+#define PhaseCarrierBufferWords 400
+
+/**
+ * Start the unmodulated carrier of the given channel on the I2S data pin (GPIO3).
+ */
+void setupPhaseCarrier(const DcfChannel &channel);
+
+/**
+ * Key the pulses of the phase carrier channel (index) in the transmission into the stream (amplitude and phase).
+ * Called from the edge timer interrupt, the transmission stays valid until it is over.
+ */
+void phaseCarrierStart(const Transmission &transmission, uint8_t index);
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <Arduino.h>
+
+// In power save mode the radio is only switched on for a batched NTP sync this often
+#define PowerSyncIntervalMs 3600000UL
+// Give up a sync after this long (retried after PowerSyncRetryMs)
+#define PowerSyncTimeoutMs 60000UL
+#define PowerSyncRetryMs 300000UL
+// loop() idles instead of spinning until this long after the next edge timer interrupt, so its own work never
+// delays one, but while the radio is off at most PowerMaxIdleMs (web server, frame cache and the next transmission
+// need their turn)
+#define PowerEdgeGuardUs 1000
+#define PowerMaxIdleMs 100
+
+// Nominal supply current of the ESP8266 module in every radio state (mA), used for the energy estimate
+#define RadioOnCurrentMa 70
+#define ModemSleepCurrentMa 18
+#define RadioOffCurrentMa 15
+
+extern bool powerSave;
+
+/**
+ * The radio is supposed to be connected, loop() only reconnects (and may start the portal) then.
+ */
+bool radioEnabled();
+
+/**
+ * Switch the radio on until the next NTP sync has been received (e.g. for the config portal).
+ */
+void wakeRadio();
+
+/**
+ * Call when the system time was set by NTP.
+ */
+void powerTimeSynced();
+
+/**
+ * Switch the radio on and off for the batched NTP syncs, account the energy and idle the rest of loop().
+ */
+void servicePower();
+
+/**
+ * Register GET /power (energy estimate of the last full hour and the current one).
+ */
+void setupPower();
@@ -0,0 +1,149 @@
+#pragma once
+
+#include <Arduino.h>
+#include "time.h"
+
+/**
+ * Time signal protocols
+ *
+ * Every protocol encodes one minute into FrameSeconds symbols (one per second) and defines the waveform of each
+ * symbol. A waveform is a list of edges in msec after the start of the second, the output toggles between idle
+ * (full carrier) and pulse (reduced carrier) at each of them, starting idle. A minute with a leap second has one
+ * symbol more, LeapSymbol is inserted at LeapIndex and the following symbols move up by one second (DCF77, WWVB
+ * and JJY: before the last second, MSF: after second 16, where the MSF time code stretches the minute). The
+ * protocol is chosen at compile time (build flag -D TIME_PROTOCOL=Msf), so the scheduler and the output backends
+ * use it without any indirection.
+ */
+
+#define MaxWaveformEdges 4
+
+struct SymbolWaveform
+{
+  uint8_t edges;
+  uint16_t edgeMs[MaxWaveformEdges];
+};
+
+/**
+ * Everything an encoder needs to know about the minute starting at the frame's own minute marker.
+ */
+struct FrameTime
+{
+  time_t start;       // UTC time of the minute marker
+  tm local;           // Local time of the minute marker
+  tm announced;       // Local time at the end of the frame, DCF77 and MSF transmit the following minute
+  bool dstChange;     // The DST state changes at the end of the hour of the announced minute
+  bool dstAtDayStart; // DST is in effect at 00:00 UTC of the current day
+  bool dstAtDayEnd;   // DST is in effect at 24:00 UTC of the current day
+  bool leapAnnounced; // A leap second follows within the hour
+  bool leapMonth;     // A leap second is inserted at the end of the current UTC month
+  bool leapSecond;    // The minute has 61 seconds
+};
+
+struct Dcf77
+{
+  static constexpr const char *Name = "DCF77";
+  static constexpr uint32_t CarrierFrequency = 77500;
+  static constexpr uint16_t ReducedAmplitude = 150; // per mille
+  static constexpr uint8_t FrameSeconds = 60;
+  static constexpr uint8_t LeapSymbol = 1; // bit 0, the marker follows in second 60
+  static constexpr uint8_t LeapIndex = FrameSeconds - 1;
+  static constexpr bool PhaseModulation = true; // PRN chips, see phase_carrier.cpp
+  static constexpr uint8_t PayloadBits = 14;    // Meteotime / civil warning bits 1..14, see meteo.cpp
+
+  // 0 = no pulse (minute marker), 1 = 100 msec (bit 0), 2 = 200 msec (bit 1)
+  static const SymbolWaveform Waveforms[3];
+
+  // Field groups of the incremental encoder
+  enum : uint8_t
+  {
+    MinuteField = 1,
+    HourField = 2,
+    DateField = 4,
+    FlagsField = 8,
+    AllFields = 15,
+  };
+
+  static void encodeFrame(uint8_t *symbols, const FrameTime &time);
+
+  /**
+   * Turn the symbols of the previous minute into the ones of time, only fields whose value changed are rewritten.
+   */
+  static void updateFrame(uint8_t *symbols, const FrameTime &previous, const FrameTime &time);
+};
+
+struct Msf
+{
+  static constexpr const char *Name = "MSF";
+  static constexpr uint32_t CarrierFrequency = 60000;
+  static constexpr uint16_t ReducedAmplitude = 0; // on/off keying
+  static constexpr uint8_t FrameSeconds = 60;
+  static constexpr uint8_t LeapSymbol = 0; // A and B bit 0
+  static constexpr uint8_t LeapIndex = 17;  // inserted after second 16, the date and time bits follow one later
+  static constexpr bool PhaseModulation = false;
+  static constexpr uint8_t PayloadBits = 0;
+
+  // 0..3 = A bit + 2 * B bit, 4 = minute marker (500 msec off)
+  static const SymbolWaveform Waveforms[5];
+
+  static void encodeFrame(uint8_t *symbols, const FrameTime &time);
+
+  // No incremental encoder, the whole frame is encoded again
+  static void updateFrame(uint8_t *symbols, const FrameTime &, const FrameTime &time) { encodeFrame(symbols, time); }
+};
+
+struct Wwvb
+{
+  static constexpr const char *Name = "WWVB";
+  static constexpr uint32_t CarrierFrequency = 60000;
+  static constexpr uint16_t ReducedAmplitude = 140; // -17 dB
+  static constexpr uint8_t FrameSeconds = 60;
+  static constexpr uint8_t LeapSymbol = 0; // bit 0, the marker follows in second 60
+  static constexpr uint8_t LeapIndex = FrameSeconds - 1;
+  static constexpr bool PhaseModulation = false;
+  static constexpr uint8_t PayloadBits = 0;
+
+  // 0 = 200 msec (bit 0), 1 = 500 msec (bit 1), 2 = 800 msec (marker)
+  static const SymbolWaveform Waveforms[3];
+
+  static void encodeFrame(uint8_t *symbols, const FrameTime &time);
+
+  // No incremental encoder, the whole frame is encoded again
+  static void updateFrame(uint8_t *symbols, const FrameTime &, const FrameTime &time) { encodeFrame(symbols, time); }
+};
+
+/**
+ * JJY keeps the full carrier first and reduces it for the rest of the second. Both stations (Fukushima 40 kHz,
+ * Kyushu 60 kHz) send the same time code.
+ */
+template <uint32_t Frequency>
+struct Jjy
+{
+  static constexpr const char *Name = "JJY";
+  static constexpr uint32_t CarrierFrequency = Frequency;
+  static constexpr uint16_t ReducedAmplitude = 100; // -20 dB
+  static constexpr uint8_t FrameSeconds = 60;
+  static constexpr uint8_t LeapSymbol = 0; // bit 0, the marker follows in second 60
+  static constexpr uint8_t LeapIndex = FrameSeconds - 1;
+  static constexpr bool PhaseModulation = false;
+  static constexpr uint8_t PayloadBits = 0;
+
+  // 0 = 800 msec full (bit 0), 1 = 500 msec full (bit 1), 2 = 200 msec full (marker)
+  static const SymbolWaveform Waveforms[3];
+
+  static void encodeFrame(uint8_t *symbols, const FrameTime &time);
+
+  // No incremental encoder, the whole frame is encoded again
+  static void updateFrame(uint8_t *symbols, const FrameTime &, const FrameTime &time) { encodeFrame(symbols, time); }
+};
+
+typedef Jjy<40000> Jjy40;
+typedef Jjy<60000> Jjy60;
+
+#ifndef TIME_PROTOCOL
+#define TIME_PROTOCOL Dcf77
+#endif
+
+typedef TIME_PROTOCOL Protocol;
+
+// Symbols of the longest frame, a minute with a leap second
+#define MaxFrameSeconds (Protocol::FrameSeconds + 1)
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <Arduino.h>
+#include "time.h"
+
+#include "channels.h"
+
+// Wake up this long before the head pulses of the scheduled burst (WiFi connection and NTP sync)
+#define WakeLeadSeconds 20
+// Bounds of the quick WiFi connection and NTP sync after a wake up (the NTP client needs a few polls 2 s apart)
+#define QuickConnectTimeoutMs 10000
+#define QuickSyncTimeoutMs 15000
+// Only part of ESP.deepSleepMax() is used, the RTC clock is not calibrated exactly
+#define DeepSleepMaxPercent 90
+// Share of the measured RTC clock error taken into the drift estimate per sync
+#define DriftGain 0.5f
+
+// Bounds of the minutes between the scheduled bursts (a burst and the wake up must fit in)
+#define MinScheduleMinutes (MaxBurstMinutes + 5)
+#define MaxScheduleMinutes 10080
+
+// Minutes between the scheduled bursts, 0 = always on (no deep sleep)
+extern uint16_t scheduleMinutes;
+
+/**
+ * Set the minutes between the scheduled bursts, clamped to its bounds (0 or less: scheduled mode off).
+ */
+void setScheduleMinutes(long minutes);
+
+/**
+ * After a wake up from deep sleep with a valid RTC state: restore the config and the estimated wall clock and
+ * return true. Goes back to sleep right away (never returns) if the scheduled burst is still far away.
+ * Returns false on a cold boot, the config has to be read from LittleFS then.
+ */
+bool resumeFromDeepSleep();
+
+/**
+ * Woken from deep sleep for a scheduled burst: no WiFiManager, the config portal is only started by its pin.
+ */
+bool scheduledWake();
+
+/**
+ * Connect with the stored WiFi credentials and fetch the time by NTP, both bounded by a timeout
+ * (the restored estimate is used if it fails).
+ */
+void quickSync();
+
+/**
+ * Call when the system time was set by NTP, learns the drift of the RTC clock.
+ */
+void scheduleTimeSynced();
+
+/**
+ * Earliest first frame allowed for the next transmission (0 = any) and whether one may be queued at all,
+ * a scheduled wake up only sends a single burst.
+ */
+time_t scheduledFirstFrame();
+bool burstAllowed();
+
+/**
+ * Note the first frame of a queued transmission.
+ */
+void burstQueued(time_t firstFrame);
+
+/**
+ * In scheduled mode: once the burst is over, store the state in RTC memory and deep sleep until the next one.
+ */
+void serviceSchedule();
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "channels.h"
+
+// Edges of different channels closer than this are written together in the same timer interrupt
+#define EdgeCoalesceUs 20
+
+// Timer1 runs at 80 MHz / 16 = 5 ticks per microsecond with a 23 bit counter (~1.6 sec)
+#define TimerTicksPerUs 5
+#define MaxTimerTicks 0x7FFFFF
+
+// Least time between starting a transmission and its first edge
+#define MinTransmissionLeadUs 100000
+
+// Transmissions which can be queued (one being sent, one prepared), a power of two
+#define TransmissionQueueSize 2
+
+/**
+ * The pulses of all channels for one burst, handed from loop() to the edge scheduler.
+ */
+struct Transmission
+{
+  uint64_t startMicros; // micros64() time of pulse 0
+  uint16_t pulseCount;  // pulses of every channel, see burstPulseCount()
+  uint8_t pulses[MaxChannels][MaxPulseNumber];
+};
+
+/**
+ * Position of one channel in its pulse array
+ */
+struct EdgeState
+{
+  const uint8_t *pulses; // symbols of the channel in the transmission being sent
+  uint64_t start;        // micros64() time of pulse 0, including the edge offset of the channel
+  uint64_t nextEdge;     // micros64() time of the next edge
+  int pulse;             // index into pulses
+  int pulseCount;        // length of pulses
+  uint8_t edge;          // index into the waveform of the current symbol
+  bool inPulse;          // the next edge ends a pulse
+  bool done;
+};
+
+/**
+ * Rewind the state to the first edge of the given channel (index) in a transmission.
+ */
+void resetEdgeState(EdgeState &state, const DcfChannel &channel, const Transmission &transmission, uint8_t index);
+
+/**
+ * Take the pending edge (begin or end of a pulse) and look up the following one.
+ */
+void advanceEdgeState(EdgeState &state, const DcfChannel &channel);
+
+/**
+ * Configure the output pins of all channels and attach the edge timer.
+ */
+void setupDcf();
+
+/**
+ * Slot for the next transmission, nullptr while the queue is full. Fill in the pulses of every channel and
+ * startMicros (micros64() timeline, every channel shifted by its edge offset), then hand it over with
+ * queueTransmission(). Must only be called from loop().
+ */
+Transmission *reserveTransmission();
+void queueTransmission();
+
+/**
+ * A transmission is queued or still being sent.
+ */
+bool isTransmitting();
+
+/**
+ * micros64() time of the next edge timer interrupt (the next edge of any channel, or the end of the transmission),
+ * 0 while nothing is being sent.
+ */
+uint64_t nextEdgeMicros();
+
+/**
+ * Convert a wall clock time (seconds since epoch) to the micros64() timeline.
+ */
+uint64_t wallClockToMicros(time_t wallClock);
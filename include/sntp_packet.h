@@ -0,0 +1,46 @@
+#pragma once
+
+// Only standard headers: requests and answers are built on the host as well
+#include <stdint.h>
+#include <stddef.h>
+
+#define SntpPacketBytes 48
+// Clock precision announced to the clients (2^-20 sec, about the microsecond resolution of the timebase)
+#define SntpPrecision -20
+// Assumed drift of the crystal since the last sync, grows the announced root dispersion
+#define SntpDriftPpm 15
+// Dispersion of the own clock added to the one of the upstream server
+#define SntpDispersionUs 1000
+// Kiss code (RFC 5905 7.4) in the reference id while there is no upstream server
+#define SntpKissCode "INIT"
+
+// Leap indicator
+#define SntpLeapNone 0
+#define SntpLeapInsert 1
+#define SntpLeapUnsynchronized 3
+
+/**
+ * The server the clock was last set from (NTP system peer or fleet master).
+ */
+struct SntpUpstream
+{
+  uint8_t stratum;          // of the upstream server, 0: none, the answers are unsynchronized (stratum 16)
+  uint32_t address;         // IPv4, first octet in the low byte (as lwIP keeps it), the reference id
+  int64_t rootDelayUs;      // to the reference clock, over the upstream server
+  int64_t rootDispersionUs;
+};
+
+/**
+ * A plain client request (mode 3) of at least SntpPacketBytes, the rest (extension fields) is ignored.
+ */
+bool sntpClientRequest(const uint8_t *packet, size_t length);
+
+/**
+ * Turn the request in packet into the answer: stratum and reference id from the upstream server (stratum 16 with a
+ * kiss code without one), reference time of the last sync, the receive timestamp and the originate timestamp
+ * taken from the request. The transmit timestamp is left to stampSntpAnswer(), right before sending.
+ */
+void buildSntpAnswer(uint8_t *packet, const SntpUpstream &upstream, uint8_t leap, int64_t referenceUs,
+                     int64_t receivedUs, int64_t sinceSyncUs);
+
+void stampSntpAnswer(uint8_t *packet, int64_t transmitUs);
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Arduino.h>
+
+#include "sntp_packet.h"
+
+#define SntpPort 123
+// Requests answered per loop() pass at most
+#define SntpMaxRequestsPerPass 4
+
+// Answer SNTP requests on UDP port 123
+extern bool sntpServerEnabled;
+
+/**
+ * Call when the system time was set (NTP or fleet master), the reference time of the answers.
+ */
+void sntpServerTimeSynced();
+
+/**
+ * Answer the pending requests.
+ */
+void serviceSntpServer();
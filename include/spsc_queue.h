@@ -0,0 +1,74 @@
+#pragma once
+
+// Only standard headers: the queue is also stress tested on the host (test/test_spsc_queue)
+#include <stdint.h>
+
+/**
+ * Lock-free ring for one producer and one consumer (e.g. loop() and an interrupt).
+ *
+ * The producer fills the slot returned by reserve() in place and publishes it with commit(), the consumer reads
+ * front() and hands the slot back with pop(). Each index is only written by its own side; the release store of an
+ * index orders the slot contents before it and pairs with the acquire load on the other side, so a slot is never
+ * seen half written. Everything is inlined into the (IRAM) callers.
+ */
+template <typename T, uint32_t Size>
+class SpscQueue
+{
+  static_assert((Size & (Size - 1)) == 0, "the queue size must be a power of two");
+
+public:
+  /**
+   * Producer: the next free slot, nullptr while the queue is full.
+   */
+  inline __attribute__((always_inline)) T *reserve()
+  {
+    const uint32_t head = __atomic_load_n(&headIndex, __ATOMIC_RELAXED);
+
+    if (head - __atomic_load_n(&tailIndex, __ATOMIC_ACQUIRE) == Size)
+      return nullptr;
+
+    return &slots[head & (Size - 1)];
+  }
+
+  /**
+   * Producer: publish the slot returned by reserve().
+   */
+  inline __attribute__((always_inline)) void commit()
+  {
+    __atomic_store_n(&headIndex, __atomic_load_n(&headIndex, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Consumer: the oldest published slot, nullptr while the queue is empty.
+   */
+  inline __attribute__((always_inline)) T *front()
+  {
+    const uint32_t tail = __atomic_load_n(&tailIndex, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&headIndex, __ATOMIC_ACQUIRE) == tail)
+      return nullptr;
+
+    return &slots[tail & (Size - 1)];
+  }
+
+  /**
+   * Consumer: release the slot returned by front() to the producer.
+   */
+  inline __attribute__((always_inline)) void pop()
+  {
+    __atomic_store_n(&tailIndex, __atomic_load_n(&tailIndex, __ATOMIC_RELAXED) + 1, __ATOMIC_RELEASE);
+  }
+
+  /**
+   * Either side: nothing published or everything popped.
+   */
+  inline __attribute__((always_inline)) bool empty() const
+  {
+    return __atomic_load_n(&headIndex, __ATOMIC_ACQUIRE) == __atomic_load_n(&tailIndex, __ATOMIC_ACQUIRE);
+  }
+
+private:
+  T slots[Size];
+  uint32_t headIndex = 0; // written by the producer only
+  uint32_t tailIndex = 0; // written by the consumer only
+};
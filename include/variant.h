@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Arduino.h>
+
+/**
+ * Firmware variants
+ *
+ * Pins and optional subsystems are chosen at compile time like the protocol (build flag
+ * -D FIRMWARE_VARIANT=MinimalVariant, see the environments in platformio.ini). The features are tested with plain
+ * ifs on constants, the compiler drops the calls of a disabled one and the linker its code and libraries
+ * (-ffunction-sections, --gc-sections).
+ * The output backends of a variant are tested with if constexpr, so even the interrupt handlers of the I2S backends
+ * are left out of IRAM when the variant does not have them.
+ */
+
+enum OutputBackend : uint8_t
+{
+  GpioOutput,    // Demodulated pulses on a GPIO
+  CarrierOutput, // 77.5 kHz carrier on the I2S data pin (GPIO3), reduced in amplitude during the pulses
+  BitstreamOutput, // Demodulated pulses rendered into a DMA bitstream on the I2S data pin (GPIO3)
+  PhaseCarrierOutput, // DCF77 carrier on the I2S data pin with the pulses and the phase modulated PRN time code
+};
+
+// Output backends of a variant, as bits of Variant::Backends
+#define BackendBit(backend) (1U << (backend))
+#define AllBackends \
+  (BackendBit(GpioOutput) | BackendBit(CarrierOutput) | BackendBit(BitstreamOutput) | BackendBit(PhaseCarrierOutput))
+
+struct FullVariant
+{
+  static constexpr const char *Name = "full";
+  static constexpr uint8_t OutputPin = 2;  // first channel
+  static constexpr uint8_t PortalPin = 14; // D5, pulled low to start the config portal
+  static constexpr bool Ota = true;
+  static constexpr bool PortalButton = true;
+  static constexpr bool Meteo = true;       // payload bits, /meteo
+  static constexpr bool Fleet = true;       // fleet master and follower
+  static constexpr bool SntpServer = true;
+  static constexpr uint8_t Backends = AllBackends;
+};
+
+/**
+ * Only the time signal on GPIO outputs: no OTA, payload, fleet, SNTP server or I2S output.
+ */
+struct MinimalVariant : FullVariant
+{
+  static constexpr const char *Name = "minimal";
+  static constexpr bool Ota = false;
+  static constexpr bool Meteo = false;
+  static constexpr bool Fleet = false;
+  static constexpr bool SntpServer = false;
+  static constexpr uint8_t Backends = BackendBit(GpioOutput);
+};
+
+/**
+ * ESP-01 with 1 MB flash: GPIO2 for the clock and GPIO0 (the flash button) for the portal, too small for OTA.
+ */
+struct Esp01Variant : FullVariant
+{
+  static constexpr const char *Name = "esp01";
+  static constexpr uint8_t PortalPin = 0;
+  static constexpr bool Ota = false;
+};
+
+#ifndef FIRMWARE_VARIANT
+#define FIRMWARE_VARIANT FullVariant
+#endif
+
+typedef FIRMWARE_VARIANT Variant;
+
+/**
+ * The output backend is compiled into this variant.
+ */
+constexpr bool hasBackend(OutputBackend backend)
+{
+  return Variant::Backends & BackendBit(backend);
+}
+
+/**
+ * All outputs are GPIOs, the edge interrupt has nothing to tell apart.
+ */
+constexpr bool gpioOnly()
+{
+  return Variant::Backends == BackendBit(GpioOutput);
+}
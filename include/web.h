@@ -0,0 +1,9 @@
+#pragma once
+
+#include <ESP8266WebServer.h>
+
+// HTTP server for the data and configuration endpoints
+extern ESP8266WebServer webServer;
+
+void setupWebServer();
+void handleWebServer();
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+// The config portal closes after this long without a client
+#define PortalTimeoutSeconds 180
+// The config portal opens when the connection stays lost this long (longer than a power save sync attempt)
+#define PortalAfterDisconnectMs 120000UL
+
+/**
+ * Set up the long-lived WiFiManager and its parameters and connect with the saved credentials. Without a
+ * connection the config portal is opened, it runs in the background and does not block setup().
+ */
+void setupWiFi();
+
+/**
+ * Open the config portal (portal pin pulled low), if it is not open already.
+ */
+void startConfigPortal();
+
+bool configPortalActive();
+
+/**
+ * Serve the config portal, take over the saved parameters, reconnect after a lost connection and open the portal
+ * if that does not succeed.
+ */
+void serviceWiFi();
@@ -0,0 +1,211 @@
+# IRAM audit: every function reachable from an interrupt handler must be linked into IRAM (or be in the mask
+# ROM). Code in flash runs through the cache, and while LittleFS or OTA access the flash a cache miss stalls the
+# interrupt until they are done, which moves the edges. After the link the IRAM sections of the ELF are
+# disassembled, the calls are followed from the roots (custom_iram_roots in platformio.ini, function names without
+# their signature) and the build fails if any reached function lies in flash.
+#
+# Calls are "call0 <address>" or, with -mlongcalls, "l32r aN, <literal>" followed by "callx0 aN", the target is
+# read from the literal pool. Calls through pointers which are not literals (e.g. a callback stored in a variable)
+# cannot be followed, their targets have to be roots themselves.
+
+Import("env")
+
+import bisect
+import re
+import struct
+import subprocess
+
+IramStart = 0x40100000
+FlashStart = 0x40200000
+
+SectionNoBits = 8
+SectionExecute = 4
+
+FunctionLine = re.compile(r"^([0-9a-f]{8}) <(.+)>:$")
+InstructionLine = re.compile(r"^\s*([0-9a-f]+):\s+(\S+)\s*(.*)$")
+Address = re.compile(r"(?:0x)?([0-9a-f]{8})\b")
+
+
+def read_sections(elf):
+    with open(elf, "rb") as file:
+        data = file.read()
+
+    shoff, = struct.unpack_from("<I", data, 0x20)
+    shentsize, shnum, shstrndx = struct.unpack_from("<HHH", data, 0x2E)
+    headers = [struct.unpack_from("<IIIIIIIIII", data, shoff + n * shentsize) for n in range(shnum)]
+    names = headers[shstrndx][4]
+
+    sections = []
+    for name, kind, flags, address, offset, size, _, _, _, _ in headers:
+        end = data.index(b"\0", names + name)
+        sections.append({"name": data[names + name:end].decode(), "kind": kind, "flags": flags,
+                         "address": address, "offset": offset, "size": size})
+
+    return data, sections
+
+
+def read_word(data, sections, address):
+    for section in sections:
+        if section["kind"] != SectionNoBits and section["address"] <= address < section["address"] + section["size"]:
+            return struct.unpack_from("<I", data, section["offset"] + address - section["address"])[0]
+
+    return None
+
+
+def executable(sections, address):
+    for section in sections:
+        if section["flags"] & SectionExecute and section["address"] <= address < section["address"] + section["size"]:
+            return True
+
+    return False
+
+
+def tool(name):
+    return env.subst("$CC").replace("gcc", name)
+
+
+def symbol_names(elf):
+    output = subprocess.check_output([tool("nm"), "-C", "-n", "--defined-only", elf], universal_newlines=True)
+    addresses, names = [], []
+
+    for line in output.splitlines():
+        fields = line.split(" ", 2)
+        if len(fields) == 3 and fields[1] in "TtWw":
+            addresses.append(int(fields[0], 16))
+            names.append(fields[2])
+
+    return addresses, names
+
+
+def function_name(symbols, address):
+    addresses, names = symbols
+    index = bisect.bisect_right(addresses, address) - 1
+
+    return names[index] if index >= 0 else hex(address)
+
+
+def disassemble(elf, sections):
+    command = [tool("objdump"), "-d", "-C", "--no-show-raw-insn"]
+    for section in sections:
+        if section["flags"] & SectionExecute and IramStart <= section["address"] < FlashStart:
+            command += ["-j", section["name"]]
+
+    return subprocess.check_output(command + [elf], universal_newlines=True)
+
+
+def call_graph(listing, data, sections):
+    """Start address -> (name, called addresses, indirect calls not followed)"""
+    functions = {}
+    current = None
+    literals = {}
+
+    for line in listing.splitlines():
+        match = FunctionLine.match(line)
+        if match:
+            current = [match.group(2), set(), 0]
+            functions[int(match.group(1), 16)] = current
+            literals = {}
+            continue
+
+        match = InstructionLine.match(line)
+        if not match or current is None:
+            continue
+
+        opcode, operands = match.group(2), match.group(3)
+        destination = operands.partition(",")[0].strip()
+        if opcode == "l32r":
+            register, _, literal = operands.partition(",")
+            address = Address.search(literal)
+            if address:
+                literals[register.strip()] = read_word(data, sections, int(address.group(1), 16))
+        elif opcode in ("mov", "mov.n"):
+            # A copied literal still is the call target
+            register, _, source = operands.partition(",")
+            target = literals.get(source.strip())
+            if target:
+                literals[register.strip()] = target
+            else:
+                literals.pop(register.strip(), None)
+        elif opcode in ("call0", "call4", "call8", "call12", "j"):
+            address = Address.search(operands)
+            if address:
+                current[1].add(int(address.group(1), 16))
+        elif opcode in ("callx0", "callx4", "callx8", "callx12", "jx"):
+            target = literals.get(operands.strip())
+            if target:
+                current[1].add(target)
+            elif opcode != "jx":
+                current[2] += 1
+        elif not opcode.startswith(("s8i", "s16i", "s32", "b", "ret")):
+            # Overwritten by anything else
+            literals.pop(destination, None)
+
+        # The return address
+        if opcode.startswith("call"):
+            literals.pop("a0", None)
+
+    return functions
+
+
+def iram_audit(source, target, env):
+    elf = str(target[0])
+    roots = env.GetProjectOption("custom_iram_roots", "").split()
+    data, sections = read_sections(elf)
+    symbols = symbol_names(elf)
+    functions = call_graph(disassemble(elf, sections), data, sections)
+
+    def base_name(name):
+        return name.split("(")[0].split("::")[-1]
+
+    # Breadth first from the roots, remembering where every function was reached from
+    starts = sorted(functions)
+    queue = [address for address in starts if base_name(functions[address][0]) in roots]
+    found = set(base_name(functions[address][0]) for address in queue)
+    reached_from = dict((address, None) for address in queue)
+    violations = []
+    unresolved = 0
+
+    while queue:
+        address = queue.pop(0)
+        _, calls, indirect = functions[address]
+        unresolved += indirect
+
+        for call in calls:
+            # The mask ROM (below IRAM) is always there, other addresses are literals disassembled as code
+            if call < IramStart or not executable(sections, call):
+                continue
+            if call >= FlashStart:
+                if call not in reached_from:
+                    reached_from[call] = address
+                    violations.append(call)
+                continue
+
+            # A jump inside the function, or into another one
+            callee = starts[bisect.bisect_right(starts, call) - 1]
+            if callee == address or callee in reached_from:
+                continue
+            reached_from[callee] = address
+            queue.append(callee)
+
+    for root in roots:
+        if root not in found:
+            print("IRAM audit: root %s not found (not linked or inlined)" % root)
+
+    if not violations:
+        print("IRAM audit: %d functions reachable from interrupts, all in IRAM (%d calls through pointers not "
+              "followed)" % (len(reached_from), unresolved))
+        return 0
+
+    for violation in violations:
+        chain = []
+        address = violation
+        while address is not None:
+            chain.append(function_name(symbols, address))
+            address = reached_from[address]
+        print("IRAM audit: %s is in flash, called from an interrupt: %s"
+              % (chain[0], " <- ".join(chain[1:])))
+
+    return 1
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", iram_audit)
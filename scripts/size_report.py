@@ -0,0 +1,47 @@
+# Size report of every firmware variant (include/variant.h): after the link the sections of the ELF are summed
+# up and printed, and the line of the environment is updated in .pio/build/size-report.txt, so after `pio run`
+# that file compares all variants.
+
+Import("env")
+
+import os
+import subprocess
+
+
+def section_sizes(elf):
+    output = subprocess.check_output([env.subst("$SIZETOOL"), "-A", elf], universal_newlines=True)
+    sizes = {}
+
+    for line in output.splitlines():
+        fields = line.split()
+        if len(fields) >= 2 and fields[1].isdigit():
+            sizes[fields[0]] = int(fields[1])
+
+    return sizes
+
+
+def size_report(source, target, env):
+    sizes = section_sizes(str(target[0]))
+    iram = sizes.get(".text", 0) + sizes.get(".text1", 0)
+    data = sizes.get(".data", 0)
+    rodata = sizes.get(".rodata", 0)
+    bss = sizes.get(".bss", 0)
+    flash = sizes.get(".irom0.text", 0) + iram + data + rodata
+
+    name = env["PIOENV"]
+    line = "%-16s flash %7d  iram %6d  dram %6d (data %d, rodata %d, bss %d)" % (
+        name, flash, iram, data + rodata + bss, data, rodata, bss)
+    print("Size report: " + line)
+
+    report = os.path.join(env.subst("$PROJECT_BUILD_DIR"), "size-report.txt")
+    lines = []
+    if os.path.exists(report):
+        with open(report) as file:
+            lines = [entry for entry in file.read().splitlines() if entry.split(" ", 1)[0] != name]
+    lines.append(line)
+
+    with open(report, "w") as file:
+        file.write("\n".join(sorted(lines)) + "\n")
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.elf", size_report)
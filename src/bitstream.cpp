@@ -0,0 +1,113 @@
+#include "bitstream.h"
+#include "i2s_dma.h"
+#include "scheduler.h"
+
+extern "C"
+{
+#include "ets_sys.h"
+}
+
+/**
+ * DMA bitstream output
+ *
+ * The waveform of one channel is rendered into a 100 kHz bitstream which I2S sends by DMA from a double-buffered
+ * descriptor ring. There is a single interrupt per buffer to render the next ~41 msec, the edges themselves are
+ * timed by the I2S clock. I2S and micros64() run from the same crystal, so once the stream has been started its
+ * samples keep their place on the micros64() timeline.
+ */
+
+#define BitstreamBufferUs ((uint32_t)BitstreamBufferSamples * BitstreamUsPerSample)
+
+static uint32_t buffers[BitstreamBuffers][BitstreamBufferWords];
+static I2sDmaDescriptor ring[BitstreamBuffers];
+
+static const DcfChannel *bitstreamChannel = nullptr;
+static EdgeState state = {nullptr, 0, 0, 0, 0, 0, false, true};
+// micros64() time of the first sample of the next buffer to render
+static uint64_t bufferStart = 0;
+
+static inline bool IRAM_ATTR outputHigh()
+{
+  // Idle is high and active is low, unless the channel is inverted
+  return state.inPulse == bitstreamChannel->inverted;
+}
+
+/**
+ * Set samples [from, to) of the buffer, the DMA sends every word from bit 31 down to bit 0.
+ */
+static void IRAM_ATTR fillSamples(uint32_t *buffer, uint32_t from, uint32_t to, bool high)
+{
+  while (from < to)
+  {
+    const uint32_t word = from / 32;
+    const uint32_t first = from % 32;
+    const uint32_t last = (to - word * 32) < 32 ? (to - word * 32) : 32;
+    const uint32_t mask = (0xFFFFFFFFUL >> first) & ~(last == 32 ? 0 : 0xFFFFFFFFUL >> last);
+
+    if (high)
+      buffer[word] |= mask;
+    else
+      buffer[word] &= ~mask;
+
+    from = word * 32 + last;
+  }
+}
+
+static void IRAM_ATTR renderBuffer(uint32_t *buffer)
+{
+  uint32_t sample = 0;
+
+  while (sample < BitstreamBufferSamples)
+  {
+    uint32_t runEnd = BitstreamBufferSamples;
+
+    if (!state.done)
+    {
+      const int64_t edgeUs = (int64_t)(state.nextEdge - bufferStart);
+
+      if (edgeUs < (int64_t)sample * BitstreamUsPerSample)
+        runEnd = sample; // Late edge, take it right now
+      else if (edgeUs < BitstreamBufferUs)
+        runEnd = (uint32_t)edgeUs / BitstreamUsPerSample;
+    }
+
+    fillSamples(buffer, sample, runEnd, outputHigh());
+    sample = runEnd;
+
+    if (sample < BitstreamBufferSamples)
+      advanceEdgeState(state, *bitstreamChannel);
+  }
+
+  bufferStart += BitstreamBufferUs;
+}
+
+static void IRAM_ATTR onBufferDone(I2sDmaDescriptor *descriptor)
+{
+  // The buffer just sent is queued again behind the other one, fill it with the samples following that one
+  renderBuffer(descriptor->buf_ptr);
+}
+
+void setupBitstream(const DcfChannel &channel)
+{
+  bitstreamChannel = &channel;
+  state.done = true;
+  state.inPulse = false;
+
+  i2sDmaInitRing(ring, BitstreamBuffers, buffers[0], BitstreamBufferWords, true);
+
+  bufferStart = micros64();
+  for (uint8_t n = 0; n < BitstreamBuffers; n++)
+    renderBuffer(buffers[n]);
+
+  i2sDmaBegin(ring, BitstreamClockDiv, BitstreamBitClockDiv, onBufferDone);
+}
+
+void IRAM_ATTR bitstreamStart(const Transmission &transmission, uint8_t index)
+{
+  if (!bitstreamChannel)
+    return;
+
+  ETS_SLC_INTR_DISABLE();
+  resetEdgeState(state, *bitstreamChannel, transmission, index);
+  ETS_SLC_INTR_ENABLE();
+}
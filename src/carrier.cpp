@@ -0,0 +1,75 @@
+#include "carrier.h"
+#include "i2s_dma.h"
+
+#include <math.h>
+
+/**
+ * Carrier synthesis (77.5 kHz for DCF77)
+ *
+ * A digital pin can only emit a square wave, its amplitude at the carrier frequency is set by the duty cycle:
+ * the fundamental of a pulse train with duty cycle D is proportional to sin(pi * D). Full amplitude uses D = 0.5,
+ * the reduced amplitude D = asin(a) / pi (DCF77: a = 0.15, about 3 of 64.5 bits per cycle). Both patterns are
+ * rendered once into RAM and the DMA loops over them forever, a pulse edge only swaps the buffer pointers of the
+ * descriptors.
+ * A small coil (tuned to the carrier with a capacitor) on GPIO3 radiates the signal to a clock at very short range.
+ */
+
+static uint32_t fullCarrier[CarrierBufferWords];
+static uint32_t reducedCarrier[CarrierBufferWords];
+static I2sDmaDescriptor carrierRing[CarrierDescriptors];
+
+static bool carrierRunning = false;
+
+static void renderCarrier(uint32_t *buffer, float amplitude)
+{
+  const uint32_t bits = CarrierBufferWords * 32;
+  // Part of a carrier cycle (in 1/bits units) the output stays high
+  const uint32_t highPhase = lroundf(asinf(amplitude) / PI * bits);
+
+  for (uint32_t word = 0; word < CarrierBufferWords; word++)
+  {
+    uint32_t value = 0;
+
+    for (uint8_t bit = 0; bit < 32; bit++)
+    {
+      const uint32_t phase = ((word * 32 + bit) * CarrierBufferCycles) % bits;
+      value = (value << 1) | (phase < highPhase ? 1 : 0);
+    }
+
+    buffer[word] = value;
+  }
+}
+
+void renderCarrierPatterns()
+{
+  renderCarrier(fullCarrier, 1.0f);
+  renderCarrier(reducedCarrier, Protocol::ReducedAmplitude / 1000.0f);
+}
+
+// Also read by the DMA interrupt of the phase modulated carrier
+const uint32_t *IRAM_ATTR carrierPattern(bool reduced)
+{
+  return reduced ? reducedCarrier : fullCarrier;
+}
+
+void setupCarrier()
+{
+  if (carrierRunning)
+    return;
+
+  renderCarrierPatterns();
+
+  i2sDmaInitRing(carrierRing, CarrierDescriptors, fullCarrier, CarrierWordsPerDescriptor, false);
+  i2sDmaBegin(carrierRing, CarrierClockDiv, CarrierBitClockDiv, nullptr);
+
+  carrierRunning = true;
+}
+
+void IRAM_ATTR carrierSetReduced(bool reduced)
+{
+  // Both buffers have the same phase at every offset, so the carrier stays continuous
+  uint32_t *buffer = reduced ? reducedCarrier : fullCarrier;
+
+  for (uint8_t n = 0; n < CarrierDescriptors; n++)
+    carrierRing[n].buf_ptr = buffer + n * CarrierWordsPerDescriptor;
+}
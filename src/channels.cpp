@@ -0,0 +1,268 @@
+#include "channels.h"
+#include "config.h"
+#include "log.h"
+#include "i2s_dma.h"
+#include "meteo.h"
+#include "frame_cache.h"
+#include "leap.h"
+
+DcfChannel channels[MaxChannels] = {
+    {DCF_OUT_PIN, false, PushPull, GpioOutput, "CET-1CEST,M3.5.0/02,M10.5.0/03", 0, 0},
+};
+uint8_t channelCount = 1;
+
+// Three complete minutes + 2 head pulses (the end of the minute before) and one tail pulse (the following marker)
+BurstConfig burstConfig = {3, 2, 1, 30};
+
+bool isValidChannelPin(int pin)
+{
+  return pin >= 0 && pin < 16;
+}
+
+DcfChannel *addChannel(uint8_t pin, const char *timezone, int timeCorrectionOffset, bool inverted)
+{
+  if (channelCount >= MaxChannels || !isValidChannelPin(pin))
+    return nullptr;
+
+  DcfChannel &channel = channels[channelCount++];
+  channel.pin = pin;
+  channel.inverted = inverted;
+  channel.mode = PushPull;
+  channel.backend = GpioOutput;
+  channel.edgeOffsetUs = 0;
+  strlcpy(channel.timezone, timezone, sizeof(channel.timezone));
+  channel.timeCorrectionOffset = timeCorrectionOffset;
+
+  return &channel;
+}
+
+bool setChannelBackend(DcfChannel &channel, OutputBackend backend)
+{
+  if (!hasBackend(backend) || (backend == PhaseCarrierOutput && !Protocol::PhaseModulation))
+    return false;
+
+  if (backend != GpioOutput)
+  {
+    for (uint8_t n = 0; n < channelCount; n++)
+    {
+      if (&channels[n] != &channel && channels[n].backend != GpioOutput)
+        return false;
+    }
+
+    channel.pin = I2S_DATA_PIN;
+  }
+
+  channel.backend = backend;
+
+  return true;
+}
+
+OutputBackend backendFromName(const char *name)
+{
+  if (strcmp(name, "carrier") == 0)
+    return CarrierOutput;
+  if (strcmp(name, "bitstream") == 0)
+    return BitstreamOutput;
+  if (strcmp(name, "carrier-pm") == 0)
+    return PhaseCarrierOutput;
+
+  return GpioOutput;
+}
+
+const char *backendName(OutputBackend backend)
+{
+  switch (backend)
+  {
+  case CarrierOutput:
+    return "carrier";
+  case BitstreamOutput:
+    return "bitstream";
+  case PhaseCarrierOutput:
+    return "carrier-pm";
+  default:
+    return "gpio";
+  }
+}
+
+void setBurstConfig(long minutes, long headPulses, long tailPulses, long gapSeconds)
+{
+  burstConfig.minutes = constrain(minutes, 1, MaxBurstMinutes);
+  burstConfig.headPulses = constrain(headPulses, 0, MaxHeadPulses);
+  burstConfig.tailPulses = constrain(tailPulses, 0, MaxTailPulses);
+  burstConfig.gapSeconds = constrain(gapSeconds, MinBurstGapSeconds, 3600);
+}
+
+uint16_t burstPulseCount(const BurstConfig &burst, time_t firstFrame)
+{
+  uint16_t count = burst.headPulses + burst.tailPulses;
+
+  for (int n = 0; n < burst.minutes; n++)
+    count += frameSeconds(firstFrame + n * 60);
+
+  return count;
+}
+
+int32_t validEdgeOffset(long edgeOffsetUs)
+{
+  return constrain(edgeOffsetUs, -MaxEdgeOffsetUs, MaxEdgeOffsetUs);
+}
+
+void channelFrameTime(const DcfChannel &channel, time_t frameStart, FrameTime *frame)
+{
+  tm probe;
+
+  // A leap second belongs to the real minute, not to the one shown
+  frame->leapAnnounced = leapSecondAnnounced(frameStart - frameStart % 60);
+  frame->leapMonth = leapSecondThisMonth(frameStart - frameStart % 60);
+  frame->leapSecond = leapSecondMinute(frameStart - frameStart % 60);
+
+  // Add time correction offset e.g. if DCF77 is send a little bit to late and the clock is 1-2 minutes behind.
+  frameStart += channel.timeCorrectionOffset;
+  frameStart -= frameStart % 60;
+
+  // Channel 0 owns the system time zone set by setTZ()
+  if (&channel != &channels[0])
+  {
+    setenv("TZ", channel.timezone, 1);
+    tzset();
+  }
+
+  frame->start = frameStart;
+  localtime_r(&frameStart, &frame->local);
+
+  const time_t announced = frameStart + 60;
+  localtime_r(&announced, &frame->announced);
+
+  // Compare with the DST state at the begin of the next hour
+  const time_t nextHour = announced - frame->announced.tm_min * 60 - frame->announced.tm_sec + 3600;
+  localtime_r(&nextHour, &probe);
+  frame->dstChange = probe.tm_isdst != frame->announced.tm_isdst;
+
+  const time_t dayStart = frameStart - frameStart % 86400;
+  localtime_r(&dayStart, &probe);
+  frame->dstAtDayStart = probe.tm_isdst > 0;
+
+  const time_t dayEnd = dayStart + 86400;
+  localtime_r(&dayEnd, &probe);
+  frame->dstAtDayEnd = probe.tm_isdst > 0;
+
+  if (&channel != &channels[0])
+  {
+    setenv("TZ", channels[0].timezone, 1);
+    tzset();
+  }
+}
+
+// Last frame encoded for every channel (without payload), the following minute only updates the fields which change
+struct EncodedFrame
+{
+  FrameTime time;
+  uint8_t symbols[Protocol::FrameSeconds]; // without a leap second
+  bool valid;
+};
+
+static EncodedFrame lastFrames[MaxChannels];
+
+#ifdef ENCODER_BENCHMARK
+static uint32_t benchmarkCycles = 0;
+static uint32_t benchmarkFullCycles = 0;
+static uint16_t benchmarkMinutes = 0;
+#endif
+
+void encodeChannelFrame(const DcfChannel &channel, time_t frameStart, uint8_t *symbols)
+{
+  EncodedFrame &last = lastFrames[&channel - channels];
+  FrameTime frame;
+
+  channelFrameTime(channel, frameStart, &frame);
+
+#ifdef ENCODER_BENCHMARK
+  const uint32_t startCycles = ESP.getCycleCount();
+#endif
+
+  if (last.valid && last.time.start + 60 == frame.start)
+  {
+    memcpy(symbols, last.symbols, Protocol::FrameSeconds);
+    Protocol::updateFrame(symbols, last.time, frame);
+  }
+  else
+    Protocol::encodeFrame(symbols, frame);
+
+#if defined(ENCODER_BENCHMARK) || defined(VERIFY_INCREMENTAL_ENCODER)
+  uint8_t check[Protocol::FrameSeconds];
+#endif
+#ifdef ENCODER_BENCHMARK
+  const uint32_t fullCycles = ESP.getCycleCount();
+  benchmarkCycles += fullCycles - startCycles;
+  Protocol::encodeFrame(check, frame);
+  benchmarkFullCycles += ESP.getCycleCount() - fullCycles;
+  if (++benchmarkMinutes == 60)
+  {
+    logInfo("encoder: %u cycles per minute, full encode %u", benchmarkCycles / benchmarkMinutes,
+            benchmarkFullCycles / benchmarkMinutes);
+    benchmarkCycles = 0;
+    benchmarkFullCycles = 0;
+    benchmarkMinutes = 0;
+  }
+#endif
+#ifdef VERIFY_INCREMENTAL_ENCODER
+  Protocol::encodeFrame(check, frame);
+  if (memcmp(check, symbols, Protocol::FrameSeconds) != 0)
+  {
+    logError("incremental encoder mismatch at %u, using the full encode", (uint32_t)frame.start);
+    memcpy(symbols, check, Protocol::FrameSeconds);
+  }
+#endif
+
+  memcpy(last.symbols, symbols, Protocol::FrameSeconds);
+  last.time = frame;
+  last.valid = true;
+
+  // Kept out of the incremental encoder, the following minute is a normal one again
+  if (frame.leapSecond)
+  {
+    memmove(symbols + Protocol::LeapIndex + 1, symbols + Protocol::LeapIndex,
+            Protocol::FrameSeconds - Protocol::LeapIndex);
+    symbols[Protocol::LeapIndex] = Protocol::LeapSymbol;
+  }
+}
+
+void resetFrameEncoder()
+{
+  for (uint8_t n = 0; n < MaxChannels; n++)
+    lastFrames[n].valid = false;
+}
+
+static void encodeFrame(const DcfChannel &channel, time_t frameStart, uint8_t *symbols)
+{
+  if (!readCachedFrame(channel, frameStart, symbols))
+    encodeChannelFrame(channel, frameStart, symbols);
+
+  applyMeteoBits(symbols, frameStart);
+}
+
+void calculateArray(const DcfChannel &channel, time_t firstFrame, const BurstConfig &burst, uint8_t *pulses)
+{
+  uint8_t neighbour[MaxFrameSeconds];
+
+  // Head pulses: the end of the minute before, to allow some clock model synchronization of the beginning frame
+  if (burst.headPulses)
+  {
+    encodeFrame(channel, firstFrame - 60, neighbour);
+    memcpy(pulses, neighbour + frameSeconds(firstFrame - 60) - burst.headPulses, burst.headPulses);
+    pulses += burst.headPulses;
+  }
+
+  for (int n = 0; n < burst.minutes; n++)
+  {
+    encodeFrame(channel, firstFrame + n * 60, pulses);
+    pulses += frameSeconds(firstFrame + n * 60);
+  }
+
+  // Tail pulses: the following minute marker to safely close the frame
+  if (burst.tailPulses)
+  {
+    encodeFrame(channel, firstFrame + burst.minutes * 60, neighbour);
+    memcpy(pulses, neighbour, burst.tailPulses);
+  }
+}
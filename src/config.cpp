@@ -0,0 +1,462 @@
+#include "config.h"
+#include "channels.h"
+#include "power.h"
+#include "schedule.h"
+#include "log.h"
+#include "fleet.h"
+#include "sntp_server.h"
+#include "ntp_client.h"
+#include "memory_stats.h"
+#include "web.h"
+
+#include "LittleFS.h"
+
+#include <ArduinoJson.h>
+
+char ntpServer[40] = "de.pool.ntp.org";
+
+// OTA settings
+unsigned int otaPort = 8266;
+char otaPassword[32] = ""; // Set OTA password via WiFi manager!
+
+// Flag for saving data
+bool shouldSaveConfig = false;
+
+static ConfigChangedCallback configChangedCallback = nullptr;
+
+// Write-behind: saveConfig() only marks the settings, they are written once they rest
+static bool configPending = false;
+static unsigned long firstChange = 0;
+static unsigned long lastChange = 0;
+static bool fileSystemMounted = false;
+
+/**
+ * The first channel is stored in the top level keys (as before multi channel support), every further channel
+ * is an entry of the "channels" array.
+ */
+static void loadChannels(JsonVariant json)
+{
+  if (json.containsKey("timezone"))
+    strlcpy(channels[0].timezone, json["timezone"] | "", sizeof(channels[0].timezone));
+  channels[0].timeCorrectionOffset = json["timeCorrectionOffset"];
+  if (json.containsKey("pin") && isValidChannelPin(json["pin"]))
+    channels[0].pin = json["pin"];
+  channels[0].inverted = json["inverted"] | false;
+  channels[0].mode = (json["openDrain"] | false) ? OpenDrain : PushPull;
+  channels[0].edgeOffsetUs = validEdgeOffset(json["edgeOffsetUs"] | 0L);
+  setChannelBackend(channels[0], backendFromName(json["output"] | "gpio"));
+
+  channelCount = 1;
+  for (JsonObject channel : json["channels"].as<JsonArray>())
+  {
+    DcfChannel *added = addChannel(channel["pin"] | -1, channel["timezone"] | (const char *)channels[0].timezone,
+                                   channel["timeCorrectionOffset"] | 0, channel["inverted"] | false);
+    if (!added)
+    {
+      logWarn("skipping invalid channel");
+      continue;
+    }
+
+    added->mode = (channel["openDrain"] | false) ? OpenDrain : PushPull;
+    added->edgeOffsetUs = validEdgeOffset(channel["edgeOffsetUs"] | 0L);
+    if (!setChannelBackend(*added, backendFromName(channel["output"] | "gpio")))
+    {
+      logWarn("only one channel can use the I2S data pin");
+    }
+  }
+}
+
+void prepareFileSystem()
+{
+  HeapScope heapScope(HeapConfig);
+
+  // Clean FS, for testing
+  // LittleFS.format();
+
+  // Read configuration from FS json
+  logDebug("mounting FS...");
+
+  if (LittleFS.begin())
+  {
+    logDebug("mounted file system");
+    fileSystemMounted = true;
+
+    // Left by a power loss while writing, the config file itself is still the previous one
+    if (LittleFS.exists(CONFIG_TEMP_FILE))
+    {
+      logWarn("removing incomplete " CONFIG_TEMP_FILE);
+      LittleFS.remove(CONFIG_TEMP_FILE);
+    }
+
+    if (LittleFS.exists(CONFIG_FILE))
+    {
+      // File exists, reading and loading
+      logDebug("reading config file");
+
+      File configFile = LittleFS.open(CONFIG_FILE, "r");
+      if (configFile)
+      {
+        logDebug("opened config file");
+
+        size_t size = configFile.size();
+        // Allocate a buffer to store contents of the file.
+        std::unique_ptr<char[]> buf(new char[size + 1]);
+
+        configFile.readBytes(buf.get(), size);
+        buf[size] = '\0';
+
+        DynamicJsonDocument json(2048);
+        auto deserializeError = deserializeJson(json, buf.get());
+        if (!deserializeError)
+        {
+          logDebug("parsed json");
+
+          strlcpy(ntpServer, json["ntpServer"] | "", sizeof(ntpServer));
+          strlcpy(otaPassword, json["otaPassword"] | "", sizeof(otaPassword));
+          otaPort = json["otaPort"];
+          loadChannels(json.as<JsonVariant>());
+          powerSave = json["powerSave"] | false;
+          setScheduleMinutes(json["scheduleMinutes"] | 0L);
+          strlcpy(syslogServer, json["syslogServer"] | "", sizeof(syslogServer));
+          if (Variant::Fleet)
+            fleetRole = fleetRoleFromName(json["fleetRole"] | "off");
+          if (Variant::SntpServer)
+            sntpServerEnabled = json["sntpServer"] | false;
+          uint8_t server = 0;
+          for (const char *name : json["ntpServers"].as<JsonArray>())
+            if (server < NtpMaxServers - 1 && name)
+              strlcpy(ntpServers[server++], name, sizeof(ntpServers[0]));
+          setBurstConfig(json["burstMinutes"] | burstConfig.minutes, json["headPulses"] | burstConfig.headPulses,
+                         json["tailPulses"] | burstConfig.tailPulses, json["burstGap"] | burstConfig.gapSeconds);
+        }
+        else
+        {
+          logError("failed to load json config");
+        }
+
+        configFile.close();
+      }
+    }
+  }
+  else
+  {
+    logError("failed to mount FS");
+  }
+  //end read
+}
+
+/**
+ * Write the settings to CONFIG_FILE atomically, false if it failed (the previous file is kept then).
+ */
+static bool writeConfigFile()
+{
+  HeapScope heapScope(HeapConfig);
+
+  // After a wake up from deep sleep only a part of the settings was restored from the RTC memory
+  if (!fileSystemMounted)
+  {
+    logWarn("config not saved, file system not mounted");
+    return false;
+  }
+
+  logDebug("saving config");
+
+  DynamicJsonDocument json(2048);
+  JsonArray extraChannels = json.createNestedArray("channels");
+  json["ntpServer"] = ntpServer;
+  json["timezone"] = channels[0].timezone;
+  json["timeCorrectionOffset"] = channels[0].timeCorrectionOffset;
+  json["pin"] = channels[0].pin;
+  json["inverted"] = channels[0].inverted;
+  json["openDrain"] = channels[0].mode == OpenDrain;
+  json["edgeOffsetUs"] = channels[0].edgeOffsetUs;
+  json["output"] = backendName(channels[0].backend);
+  json["burstMinutes"] = burstConfig.minutes;
+  json["headPulses"] = burstConfig.headPulses;
+  json["tailPulses"] = burstConfig.tailPulses;
+  json["burstGap"] = burstConfig.gapSeconds;
+  json["powerSave"] = powerSave;
+  json["scheduleMinutes"] = scheduleMinutes;
+  json["syslogServer"] = syslogServer;
+  if (Variant::Fleet)
+    json["fleetRole"] = fleetRoleName(fleetRole);
+  if (Variant::SntpServer)
+    json["sntpServer"] = sntpServerEnabled;
+  JsonArray servers = json.createNestedArray("ntpServers");
+  for (uint8_t n = 0; n < NtpMaxServers - 1; n++)
+    if (ntpServers[n][0])
+      servers.add(ntpServers[n]);
+  json["otaPassword"] = otaPassword;
+  json["otaPort"] = otaPort;
+
+  for (uint8_t n = 1; n < channelCount; n++)
+  {
+    JsonObject channel = extraChannels.createNestedObject();
+    channel["pin"] = channels[n].pin;
+    channel["timezone"] = channels[n].timezone;
+    channel["timeCorrectionOffset"] = channels[n].timeCorrectionOffset;
+    channel["inverted"] = channels[n].inverted;
+    channel["openDrain"] = channels[n].mode == OpenDrain;
+    channel["edgeOffsetUs"] = channels[n].edgeOffsetUs;
+    channel["output"] = backendName(channels[n].backend);
+  }
+
+  // The complete file is written beside the old one, the rename replaces it in one step (closing the file
+  // commits it to the flash). A power loss leaves either the old or the new file, never a torn one
+  File configFile = LittleFS.open(CONFIG_TEMP_FILE, "w");
+  if (!configFile)
+  {
+    logError("failed to open " CONFIG_TEMP_FILE " for writing");
+    return false;
+  }
+
+  const size_t size = measureJson(json);
+  const size_t written = serializeJson(json, configFile);
+  configFile.close();
+
+  if (written != size)
+  {
+    logError("config write failed (%u of %u bytes)", written, size);
+    LittleFS.remove(CONFIG_TEMP_FILE);
+    return false;
+  }
+
+  if (!LittleFS.rename(CONFIG_TEMP_FILE, CONFIG_FILE))
+  {
+    logError("failed to replace " CONFIG_FILE);
+    return false;
+  }
+
+  return true;
+}
+
+void saveConfig()
+{
+  if (!configPending)
+    firstChange = millis();
+  configPending = true;
+  lastChange = millis();
+}
+
+void flushConfig()
+{
+  if (!configPending)
+    return;
+
+  // Retried after the delay if the write failed, dropped if it cannot be written at all
+  configPending = fileSystemMounted && !writeConfigFile();
+  firstChange = lastChange = millis();
+}
+
+void serviceConfig()
+{
+  const unsigned long now = millis();
+
+  if (configPending && (now - lastChange >= ConfigWriteDelayMs || now - firstChange >= ConfigWriteMaxDelayMs))
+    flushConfig();
+}
+
+void takeConfigSnapshot(ConfigSnapshot &snapshot)
+{
+  memset(&snapshot, 0, sizeof(snapshot));
+  strlcpy(snapshot.ntpServer, ntpServer, sizeof(snapshot.ntpServer));
+  memcpy(snapshot.ntpServers, ntpServers, sizeof(snapshot.ntpServers));
+  strlcpy(snapshot.timezone, channels[0].timezone, sizeof(snapshot.timezone));
+  snapshot.timeCorrectionOffset = channels[0].timeCorrectionOffset;
+  snapshot.edgeOffsetUs = channels[0].edgeOffsetUs;
+  snapshot.burst = burstConfig;
+  strlcpy(snapshot.otaPassword, otaPassword, sizeof(snapshot.otaPassword));
+  snapshot.otaPort = otaPort;
+}
+
+void restoreConfigSnapshot(const ConfigSnapshot &snapshot)
+{
+  strlcpy(ntpServer, snapshot.ntpServer, sizeof(ntpServer));
+  memcpy(ntpServers, snapshot.ntpServers, sizeof(ntpServers));
+  strlcpy(channels[0].timezone, snapshot.timezone, sizeof(channels[0].timezone));
+  channels[0].timeCorrectionOffset = snapshot.timeCorrectionOffset;
+  channels[0].edgeOffsetUs = snapshot.edgeOffsetUs;
+  burstConfig = snapshot.burst;
+  strlcpy(otaPassword, snapshot.otaPassword, sizeof(otaPassword));
+  otaPort = snapshot.otaPort;
+}
+
+uint8_t configChanges(const ConfigSnapshot &before)
+{
+  uint8_t changes = 0;
+
+  if (strcmp(before.timezone, channels[0].timezone))
+    changes |= ConfigTimezone;
+  if (strcmp(before.ntpServer, ntpServer))
+    changes |= ConfigNtpServers;
+  for (uint8_t n = 0; n < NtpMaxServers - 1; n++)
+    if (strcmp(before.ntpServers[n], ntpServers[n]))
+      changes |= ConfigNtpServers;
+  if (before.timeCorrectionOffset != channels[0].timeCorrectionOffset)
+    changes |= ConfigFrames;
+  if (strcmp(before.otaPassword, otaPassword) || before.otaPort != otaPort)
+    changes |= ConfigOta;
+  if (before.edgeOffsetUs != channels[0].edgeOffsetUs || memcmp(&before.burst, &burstConfig, sizeof(burstConfig)))
+    changes |= ConfigOther;
+
+  return changes;
+}
+
+void setConfigChangedCallback(ConfigChangedCallback callback)
+{
+  configChangedCallback = callback;
+}
+
+void notifyConfigChanged(uint8_t changes)
+{
+  if (changes && configChangedCallback)
+    configChangedCallback(changes);
+}
+
+// POSIX TZ: a name of at least three letters (or quoted in <>) followed by the offset, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+static bool validTimezone(const char *timezone)
+{
+  const char *offset = timezone;
+
+  if (*offset == '<')
+  {
+    offset = strchr(offset, '>');
+    if (!offset)
+      return false;
+    offset++;
+  }
+  else
+  {
+    while (isalpha(*offset))
+      offset++;
+    if (offset - timezone < 3)
+      return false;
+  }
+
+  if (*offset == '+' || *offset == '-')
+    offset++;
+
+  return isdigit(*offset);
+}
+
+// A string setting, rejected if it is no string or does not fit
+static bool setString(char *target, size_t size, JsonVariant value)
+{
+  if (!value.is<const char *>() || strlen(value.as<const char *>()) >= size)
+    return false;
+
+  strlcpy(target, value.as<const char *>(), size);
+  return true;
+}
+
+/**
+ * Take over the keys of a PUT /config, the message of the first rejected one (the settings are restored then).
+ */
+static String applyConfigJson(JsonObject json)
+{
+  long burst[] = {burstConfig.minutes, burstConfig.headPulses, burstConfig.tailPulses, burstConfig.gapSeconds};
+  static const char *const burstKeys[] = {"burstMinutes", "headPulses", "tailPulses", "burstGap"};
+
+  for (JsonPair pair : json)
+  {
+    const char *key = pair.key().c_str();
+    JsonVariant value = pair.value();
+    bool valid = true;
+    uint8_t n = 0;
+
+    while (n < 4 && strcmp(key, burstKeys[n]))
+      n++;
+
+    if (n < 4)
+    {
+      valid = value.is<long>();
+      burst[n] = value.as<long>();
+    }
+    else if (!strcmp(key, "ntpServer"))
+      valid = setString(ntpServer, sizeof(ntpServer), value) && ntpServer[0];
+    else if (!strcmp(key, "ntpServers"))
+    {
+      JsonArray servers = value.as<JsonArray>();
+      valid = value.is<JsonArray>() && servers.size() < NtpMaxServers;
+      for (uint8_t server = 0; valid && server < NtpMaxServers - 1; server++)
+        if (server < servers.size())
+          valid = setString(ntpServers[server], sizeof(ntpServers[0]), servers[server]);
+        else
+          ntpServers[server][0] = '\0';
+    }
+    else if (!strcmp(key, "timezone"))
+      valid = setString(channels[0].timezone, sizeof(channels[0].timezone), value) &&
+              validTimezone(channels[0].timezone);
+    else if (!strcmp(key, "timeCorrectionOffset"))
+    {
+      valid = value.is<int>();
+      channels[0].timeCorrectionOffset = value.as<int>();
+    }
+    else if (!strcmp(key, "edgeOffsetUs"))
+    {
+      valid = value.is<long>() && validEdgeOffset(value.as<long>()) == value.as<long>();
+      channels[0].edgeOffsetUs = validEdgeOffset(value.as<long>());
+    }
+    else if (Variant::Ota && !strcmp(key, "otaPassword"))
+      valid = setString(otaPassword, sizeof(otaPassword), value);
+    else if (Variant::Ota && !strcmp(key, "otaPort"))
+    {
+      valid = value.is<long>() && value.as<long>() > 0 && value.as<long>() <= 65535;
+      otaPort = value.as<unsigned int>();
+    }
+    else
+      return String("unknown setting ") + key;
+
+    if (!valid)
+      return String("invalid ") + key;
+  }
+
+  // Clamped to the bounds, a value out of them is rejected
+  setBurstConfig(burst[0], burst[1], burst[2], burst[3]);
+  const long applied[] = {burstConfig.minutes, burstConfig.headPulses, burstConfig.tailPulses, burstConfig.gapSeconds};
+  for (uint8_t n = 0; n < 4; n++)
+    if (applied[n] != burst[n])
+      return String("invalid ") + burstKeys[n];
+
+  return String();
+}
+
+static void handleConfigPut()
+{
+  HeapScope heapScope(HeapConfig);
+
+  DynamicJsonDocument json(1024);
+  if (deserializeJson(json, webServer.arg("plain")) || !json.is<JsonObject>())
+  {
+    webServer.send(400, "text/plain", "Expected a JSON object of settings");
+    return;
+  }
+
+  ConfigSnapshot before;
+  takeConfigSnapshot(before);
+
+  const String error = applyConfigJson(json.as<JsonObject>());
+  if (error.length())
+  {
+    restoreConfigSnapshot(before);
+    // The message only goes to the client, a log record would outlive the string
+    logWarn("PUT /config rejected, settings restored");
+    webServer.send(400, "text/plain", error);
+    return;
+  }
+
+  const uint8_t changes = configChanges(before);
+  if (changes)
+  {
+    notifyConfigChanged(changes);
+    saveConfig();
+  }
+
+  logInfo("config changed (0x%02x)", changes);
+  webServer.send(200, "text/plain", changes ? "applied" : "unchanged");
+}
+
+void setupConfigService()
+{
+  webServer.on("/config", HTTP_PUT, handleConfigPut);
+}
@@ -0,0 +1,249 @@
+#include "fleet.h"
+#include "config.h"
+#include "channels.h"
+#include "frame_cache.h"
+#include "meteo.h"
+#include "leap.h"
+#include "memory_stats.h"
+#include "log.h"
+#include "ntp_client.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <sys/time.h>
+
+/**
+ * Fleet mode (master and followers)
+ *
+ * With many emulators in one network only the master syncs to NTP and encodes frames. Every FleetIntervalMs it
+ * multicasts the frames of its first channel for the current and the following minutes (payload bits included)
+ * together with its wall clock at the moment of sending. Followers step their clock to the master (using the
+ * packet delayed least of the last few, the delay only ever adds) and put the received frames into the frame
+ * cache of their channels with the same time zone and time correction offset as the master's first channel, the
+ * transmissions are scheduled from there as usual. Their other channels encode their own frames. Every packet
+ * repeats the frames of the whole lookahead, so a lost packet costs nothing.
+ */
+
+FleetRole fleetRole = FleetOff;
+
+static const char *const roleNames[] = {"off", "master", "follower"};
+
+// Constructed on first use: a variant without the fleet mode must not link the UDP code through a static constructor
+static WiFiUDP &fleetUdp()
+{
+  static WiFiUDP udp;
+  return udp;
+}
+
+static bool joined = false;
+
+// Master: the time came from NTP, sequence and time of the last packet
+static bool synced = false;
+static uint32_t sequence = 0;
+static unsigned long lastSent = 0;
+
+// Follower: clock offsets of the last packets, the last packet taken and the channels fed with its frames
+static int64_t offsets[FleetOffsetWindow];
+static uint8_t offsetCount = 0;
+static FleetFollowerState followerState = {false, 0, 0};
+static bool fedChannels[MaxChannels];
+// Follower: the master as upstream server of the SNTP answers
+static SntpUpstream master = {0, 0, 0, 0};
+
+// Static, too large for the stack
+static FleetPacket packet;
+static uint8_t buffer[FleetPacketBytes];
+
+static int64_t wallClockUs()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+FleetRole fleetRoleFromName(const char *name)
+{
+  for (uint8_t n = 0; n < sizeof(roleNames) / sizeof(roleNames[0]); n++)
+    if (strcmp(name, roleNames[n]) == 0)
+      return (FleetRole)n;
+
+  return FleetOff;
+}
+
+const char *fleetRoleName(FleetRole role)
+{
+  return roleNames[role];
+}
+
+bool fleetFeedsChannel(uint8_t channel)
+{
+  return fleetRole == FleetFollower && fedChannels[channel];
+}
+
+bool fleetUpstream(SntpUpstream &upstream)
+{
+  upstream = master;
+  return fleetRole == FleetFollower && master.stratum != 0;
+}
+
+void fleetTimeSynced()
+{
+  synced = true;
+}
+
+static void sendPacket()
+{
+  const time_t now = time(nullptr);
+  const time_t currentMinute = now - now % 60;
+
+  strlcpy(packet.protocol, Protocol::Name, sizeof(packet.protocol));
+  packet.carrierFrequency = Protocol::CarrierFrequency;
+  packet.sequence = sequence++;
+  strlcpy(packet.timezone, channels[0].timezone, sizeof(packet.timezone));
+  packet.timeCorrectionOffset = channels[0].timeCorrectionOffset;
+  SntpUpstream upstream;
+  packet.stratum = ntpUpstream(upstream) ? upstream.stratum + 1 : 16;
+  packet.frameCount = FleetFrames;
+
+  for (uint8_t n = 0; n < FleetFrames; n++)
+  {
+    FleetFrame &frame = packet.frames[n];
+
+    frame.minute = currentMinute + n * 60;
+    frame.seconds = frameSeconds(frame.minute);
+    if (!readCachedFrame(channels[0], frame.minute, frame.symbols))
+      encodeChannelFrame(channels[0], frame.minute, frame.symbols);
+    applyMeteoBits(frame.symbols, frame.minute);
+  }
+
+  // Stamped last, the encoding above must not delay it
+  packet.sentEpochUs = wallClockUs();
+  const size_t length = encodeFleetPacket(packet, buffer, sizeof(buffer));
+
+  fleetUdp().beginPacketMulticast(IPAddress(FleetGroup), FleetPort, WiFi.localIP());
+  fleetUdp().write(buffer, length);
+  fleetUdp().endPacket();
+}
+
+static void stepClock(int64_t offsetUs)
+{
+  const int64_t corrected = wallClockUs() + offsetUs;
+  const struct timeval tv = {(time_t)(corrected / 1000000LL), (suseconds_t)(corrected % 1000000LL)};
+
+  settimeofday(&tv, nullptr);
+  logInfo("clock stepped by %d us to the fleet master", (int32_t)offsetUs);
+}
+
+static void adjustClock(int64_t offsetUs)
+{
+  // Not set at all yet
+  if (time(nullptr) < MinValidTime)
+  {
+    stepClock(offsetUs);
+    offsetCount = 0;
+    return;
+  }
+
+  offsets[offsetCount++] = offsetUs;
+  if (offsetCount < FleetOffsetWindow)
+    return;
+  offsetCount = 0;
+
+  int64_t best = offsets[0];
+  for (uint8_t n = 1; n < FleetOffsetWindow; n++)
+    if (offsets[n] > best)
+      best = offsets[n];
+
+  if (best > FleetMaxOffsetUs || best < -FleetMaxOffsetUs)
+    stepClock(best);
+}
+
+static void receivePackets()
+{
+  while (fleetUdp().parsePacket() > 0)
+  {
+    const int64_t receivedUs = wallClockUs();
+    const int length = fleetUdp().read(buffer, sizeof(buffer));
+
+    const bool taken = followerState.taken;
+    const uint32_t expectedSequence = followerState.sequence + 1;
+
+    FleetAcceptance acceptance = FleetForeign;
+
+    if (length > 0 && decodeFleetPacket(buffer, length, &packet))
+      acceptance = acceptFleetPacket(packet, Protocol::Name, Protocol::CarrierFrequency, followerState);
+    if (acceptance == FleetForeign)
+    {
+      logWarn("ignoring a fleet packet of another format or protocol");
+      continue;
+    }
+    if (acceptance == FleetStale)
+    {
+      logDebug("ignoring a stale fleet packet");
+      continue;
+    }
+
+    if (taken && packet.sequence != expectedSequence)
+      logDebug("%u fleet packets lost", packet.sequence - expectedSequence);
+
+    adjustClock(packet.sentEpochUs - receivedUs);
+
+    master.stratum = packet.stratum < 16 ? packet.stratum : 0;
+    master.address = (uint32_t)fleetUdp().remoteIP();
+
+    // Followers have no leap second table of their own. Taken over first, a new one drops the cached frames
+    for (uint8_t n = 0; n < packet.frameCount; n++)
+      if (packet.frames[n].seconds == MaxFrameSeconds)
+        addLeapSecond((time_t)packet.frames[n].minute + 60);
+
+    // The frames are local time of the master, only channels showing the same time take them
+    for (uint8_t c = 0; c < channelCount; c++)
+      fedChannels[c] = strcmp(channels[c].timezone, packet.timezone) == 0 &&
+                       channels[c].timeCorrectionOffset == packet.timeCorrectionOffset;
+
+    for (uint8_t n = 0; n < packet.frameCount; n++)
+    {
+      const FleetFrame &frame = packet.frames[n];
+
+      if (frame.seconds != Protocol::FrameSeconds && frame.seconds != MaxFrameSeconds)
+        continue;
+      for (uint8_t c = 0; c < channelCount; c++)
+        if (fedChannels[c])
+          storeCachedFrame(channels[c], (time_t)frame.minute, frame.symbols);
+    }
+  }
+}
+
+void serviceFleet()
+{
+  if (fleetRole == FleetOff)
+    return;
+
+  HeapScope heapScope(HeapFleet);
+
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    joined = false;
+    return;
+  }
+
+  if (fleetRole == FleetMaster)
+  {
+    if (synced && time(nullptr) >= MinValidTime && millis() - lastSent >= FleetIntervalMs)
+    {
+      lastSent = millis();
+      sendPacket();
+    }
+    return;
+  }
+
+  if (!joined)
+  {
+    joined = fleetUdp().beginMulticast(WiFi.localIP(), IPAddress(FleetGroup), FleetPort);
+    logInfo("%s the fleet group", joined ? "joined" : "failed to join");
+  }
+
+  if (joined)
+    receivePackets();
+}
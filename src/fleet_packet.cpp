@@ -0,0 +1,140 @@
+#include "fleet_packet.h"
+
+#include <string.h>
+
+/**
+ * Fleet packet format
+ *
+ *   "DCFf", version, protocol name (6 bytes, zero padded), carrier frequency (Hz), sequence,
+ *   sent time (usec since the epoch, signed), time zone of the frames (39 bytes, zero padded), time correction
+ *   offset (seconds, signed), stratum, frame count, then for every frame:
+ *   minute (UTC seconds, signed), symbol count, symbols (low nibble first)
+ *
+ * All integers little endian.
+ */
+
+static uint8_t *putUint(uint8_t *out, uint64_t value, uint8_t bytes)
+{
+  for (uint8_t n = 0; n < bytes; n++)
+    *out++ = value >> (8 * n);
+  return out;
+}
+
+static const uint8_t *getUint(const uint8_t *in, uint64_t *value, uint8_t bytes)
+{
+  *value = 0;
+  for (uint8_t n = 0; n < bytes; n++)
+    *value |= (uint64_t)*in++ << (8 * n);
+  return in;
+}
+
+size_t encodeFleetPacket(const FleetPacket &packet, uint8_t *buffer, size_t size)
+{
+  if (packet.frameCount > FleetFrames)
+    return 0;
+
+  size_t length = FleetHeaderBytes;
+  for (uint8_t n = 0; n < packet.frameCount; n++)
+  {
+    if (packet.frames[n].seconds > FleetMaxFrameSeconds)
+      return 0;
+    length += FleetFrameHeaderBytes + (packet.frames[n].seconds + 1) / 2;
+  }
+  if (length > size)
+    return 0;
+
+  uint8_t *out = buffer;
+  memcpy(out, FleetMagic, 4);
+  out += 4;
+  *out++ = FleetVersion;
+  memset(out, 0, FleetNameLength);
+  memcpy(out, packet.protocol, strnlen(packet.protocol, FleetNameLength));
+  out += FleetNameLength;
+  out = putUint(out, packet.carrierFrequency, 4);
+  out = putUint(out, packet.sequence, 4);
+  out = putUint(out, (uint64_t)packet.sentEpochUs, 8);
+  memset(out, 0, FleetTimezoneLength);
+  memcpy(out, packet.timezone, strnlen(packet.timezone, FleetTimezoneLength));
+  out += FleetTimezoneLength;
+  out = putUint(out, (uint32_t)packet.timeCorrectionOffset, 4);
+  *out++ = packet.stratum;
+  *out++ = packet.frameCount;
+
+  for (uint8_t n = 0; n < packet.frameCount; n++)
+  {
+    const FleetFrame &frame = packet.frames[n];
+
+    out = putUint(out, (uint64_t)frame.minute, 8);
+    *out++ = frame.seconds;
+    for (uint8_t s = 0; s < frame.seconds; s += 2)
+      *out++ = (frame.symbols[s] & 0x0F) | (s + 1 < frame.seconds ? (frame.symbols[s + 1] & 0x0F) << 4 : 0);
+  }
+
+  return length;
+}
+
+bool decodeFleetPacket(const uint8_t *buffer, size_t length, FleetPacket *packet)
+{
+  const uint8_t *in = buffer;
+  const uint8_t *end = buffer + length;
+  uint64_t value;
+
+  if (length < FleetHeaderBytes || memcmp(in, FleetMagic, 4) != 0 || in[4] != FleetVersion)
+    return false;
+  in += 5;
+
+  memcpy(packet->protocol, in, FleetNameLength);
+  packet->protocol[FleetNameLength] = '\0';
+  in += FleetNameLength;
+  in = getUint(in, &value, 4);
+  packet->carrierFrequency = value;
+  in = getUint(in, &value, 4);
+  packet->sequence = value;
+  in = getUint(in, &value, 8);
+  packet->sentEpochUs = (int64_t)value;
+  memcpy(packet->timezone, in, FleetTimezoneLength);
+  packet->timezone[FleetTimezoneLength] = '\0';
+  in += FleetTimezoneLength;
+  in = getUint(in, &value, 4);
+  packet->timeCorrectionOffset = (int32_t)(uint32_t)value;
+  packet->stratum = *in++;
+  packet->frameCount = *in++;
+  if (packet->frameCount > FleetFrames)
+    return false;
+
+  for (uint8_t n = 0; n < packet->frameCount; n++)
+  {
+    FleetFrame &frame = packet->frames[n];
+
+    if (end - in < FleetFrameHeaderBytes)
+      return false;
+    in = getUint(in, &value, 8);
+    frame.minute = (int64_t)value;
+    frame.seconds = *in++;
+    if (frame.seconds > FleetMaxFrameSeconds || end - in < (frame.seconds + 1) / 2)
+      return false;
+
+    for (uint8_t s = 0; s < frame.seconds; s++)
+      frame.symbols[s] = (in[s / 2] >> (s % 2 * 4)) & 0x0F;
+    memset(frame.symbols + frame.seconds, 0, FleetMaxFrameSeconds - frame.seconds);
+    in += (frame.seconds + 1) / 2;
+  }
+
+  return true;
+}
+
+FleetAcceptance acceptFleetPacket(const FleetPacket &packet, const char *protocol, uint32_t carrierFrequency,
+                                  FleetFollowerState &state)
+{
+  if (strcmp(packet.protocol, protocol) != 0 || packet.carrierFrequency != carrierFrequency)
+    return FleetForeign;
+
+  if (state.taken && (int32_t)(packet.sequence - state.sequence) <= 0 && packet.sentEpochUs <= state.sentEpochUs)
+    return FleetStale;
+
+  state.taken = true;
+  state.sequence = packet.sequence;
+  state.sentEpochUs = packet.sentEpochUs;
+
+  return FleetAccepted;
+}
@@ -0,0 +1,131 @@
+#include "frame_cache.h"
+#include "config.h"
+#include "fleet.h"
+#include "log.h"
+
+/**
+ * Lookahead frame cache
+ *
+ * Encoding a minute needs several localtime_r() calls (and switching TZ for every channel but the first), so the
+ * frames are encoded in the background, one per loop() pass, for the next FRAME_CACHE_MINUTES minutes. Every
+ * channel has a ring of frames indexed by minute, two symbols packed into each byte. A transmission only copies
+ * its minutes out of the ring and falls back to encoding on the spot if one is missing.
+ */
+
+#define PackedFrameBytes ((MaxFrameSeconds + 1) / 2)
+
+struct CachedFrame
+{
+  time_t minute; // UTC time of the minute marker, 0 = empty
+  uint8_t packed[PackedFrameBytes];
+};
+
+static CachedFrame frameCache[MaxChannels][FRAME_CACHE_MINUTES];
+// Next minute to encode for every channel
+static time_t fillCursor[MaxChannels];
+
+// Wall clock and micros64() at the last loop() pass, to tell a stepped clock from an SNTP fine adjustment
+static time_t referenceTime = 0;
+static uint64_t referenceMicros = 0;
+
+static CachedFrame &cacheSlot(uint8_t channel, time_t minute)
+{
+  return frameCache[channel][(minute / 60) % FRAME_CACHE_MINUTES];
+}
+
+static void packFrame(const uint8_t *symbols, uint8_t *packed)
+{
+  for (uint8_t n = 0; n < PackedFrameBytes; n++)
+  {
+    const uint8_t high = 2 * n + 1 < MaxFrameSeconds ? symbols[2 * n + 1] : 0;
+    packed[n] = symbols[2 * n] | high << 4;
+  }
+}
+
+static void unpackFrame(const uint8_t *packed, uint8_t *symbols)
+{
+  for (uint8_t n = 0; n < MaxFrameSeconds; n++)
+    symbols[n] = (packed[n / 2] >> (n % 2 * 4)) & 0x0F;
+}
+
+void serviceFrameCache()
+{
+  const time_t now = time(nullptr);
+
+  referenceTime = now;
+  referenceMicros = micros64();
+
+  if (now < MinValidTime)
+    return;
+
+  const time_t currentMinute = now - now % 60;
+  const time_t windowEnd = currentMinute + FRAME_CACHE_MINUTES * 60;
+
+  for (uint8_t n = 0; n < channelCount; n++)
+  {
+    // A fleet follower stores the master's frames there
+    if (Variant::Fleet && fleetFeedsChannel(n))
+      continue;
+
+    if (fillCursor[n] < currentMinute)
+      fillCursor[n] = currentMinute;
+    if (fillCursor[n] >= windowEnd)
+      continue;
+
+    // Consecutive minutes, so the incremental encoder only has to update the changed fields. A minute without a
+    // leap second leaves the last symbol unwritten, it is packed as 0 (no edges) instead of stack garbage
+    uint8_t symbols[MaxFrameSeconds] = {};
+    CachedFrame &slot = cacheSlot(n, fillCursor[n]);
+
+    encodeChannelFrame(channels[n], fillCursor[n], symbols);
+    packFrame(symbols, slot.packed);
+    slot.minute = fillCursor[n];
+    fillCursor[n] += 60;
+
+    return;
+  }
+}
+
+bool readCachedFrame(const DcfChannel &channel, time_t frameStart, uint8_t *symbols)
+{
+  const CachedFrame &slot = cacheSlot(&channel - channels, frameStart);
+
+  if (slot.minute != frameStart)
+    return false;
+
+  unpackFrame(slot.packed, symbols);
+
+  return true;
+}
+
+void storeCachedFrame(const DcfChannel &channel, time_t frameStart, const uint8_t *symbols)
+{
+  CachedFrame &slot = cacheSlot(&channel - channels, frameStart);
+
+  packFrame(symbols, slot.packed);
+  slot.minute = frameStart;
+}
+
+void invalidateFrameCache()
+{
+  for (uint8_t n = 0; n < MaxChannels; n++)
+  {
+    fillCursor[n] = 0;
+    for (uint8_t m = 0; m < FRAME_CACHE_MINUTES; m++)
+      frameCache[n][m].minute = 0;
+  }
+  // Its last frame may be one of the dropped ones
+  resetFrameEncoder();
+
+  logDebug("frame cache invalidated");
+}
+
+void frameCacheTimeSet()
+{
+  // The frames themselves only depend on their minute, but a stepped clock moves the window
+  const time_t expected = referenceTime + (micros64() - referenceMicros) / 1000000;
+  const time_t step = time(nullptr) - expected;
+
+  if (step > ClockStepSeconds || step < -ClockStepSeconds)
+    invalidateFrameCache();
+}
@@ -0,0 +1,106 @@
+#include "i2s_dma.h"
+
+extern "C"
+{
+#include "osapi.h"
+#include "ets_sys.h"
+#include "i2s_reg.h"
+}
+
+static I2sDmaBufferDone bufferDoneCallback = nullptr;
+
+// The SLC transmit link is not used but must point to a valid descriptor
+static uint32_t unusedWord = 0;
+static I2sDmaDescriptor unusedDescriptor = {4, 4, 0, 0, 1, 1, &unusedWord, &unusedDescriptor};
+
+static void IRAM_ATTR onSlcInterrupt(void *)
+{
+  const uint32_t status = SLCIS;
+  SLCIC = 0xFFFFFFFF;
+
+  if ((status & SLCIRXEOF) && bufferDoneCallback)
+    bufferDoneCallback((I2sDmaDescriptor *)SLCRXEDA);
+}
+
+void i2sDmaInitRing(I2sDmaDescriptor *ring, uint8_t count, uint32_t *buffer, uint16_t wordsPerDescriptor, bool withInterrupt)
+{
+  for (uint8_t n = 0; n < count; n++)
+  {
+    I2sDmaDescriptor &descriptor = ring[n];
+
+    descriptor.owner = 1;
+    descriptor.eof = withInterrupt ? 1 : 0;
+    descriptor.sub_sof = 0;
+    descriptor.unused = 0;
+    descriptor.datalen = wordsPerDescriptor * sizeof(uint32_t);
+    descriptor.blocksize = wordsPerDescriptor * sizeof(uint32_t);
+    descriptor.buf_ptr = buffer + n * wordsPerDescriptor;
+    descriptor.next_link_ptr = &ring[(n + 1) % count];
+  }
+}
+
+void i2sDmaBegin(I2sDmaDescriptor *ring, uint8_t clockDiv, uint8_t bitClockDiv, I2sDmaBufferDone bufferDone)
+{
+  bufferDoneCallback = bufferDone;
+
+  // Reset DMA
+  ETS_SLC_INTR_DISABLE();
+  SLCC0 |= SLCRXLR | SLCTXLR;
+  SLCC0 &= ~(SLCRXLR | SLCTXLR);
+  SLCIC = 0xFFFFFFFF;
+
+  // Configure DMA
+  SLCC0 &= ~(SLCMM << SLCM);     // Clear DMA mode
+  SLCC0 |= (1 << SLCM);          // Set DMA mode to 1
+  SLCRXDC |= SLCBINR | SLCBTNR;  // Enable INFOR_NO_REPLACE and TOKEN_NO_REPLACE
+  SLCRXDC &= ~(SLCBRXFE | SLCBRXEM | SLCBRXFM); // Disable RX_FILL, RX_EOF_MODE and RX_FILL_MODE
+
+  // Feed DMA the descriptor addresses, "RX" is seen from the SLC side (memory -> I2S)
+  SLCTXL &= ~(SLCTXLAM << SLCTXLA);
+  SLCTXL |= (uint32_t)&unusedDescriptor << SLCTXLA;
+  SLCRXL &= ~(SLCRXLAM << SLCRXLA);
+  SLCRXL |= (uint32_t)ring << SLCRXLA;
+
+  ETS_SLC_INTR_ATTACH(onSlcInterrupt, nullptr);
+  SLCIE = bufferDone ? SLCIRXEOF : 0;
+  ETS_SLC_INTR_ENABLE();
+
+  // Start transmission
+  SLCTXL |= SLCTXLS;
+  SLCRXL |= SLCRXLS;
+
+  pinMode(I2S_DATA_PIN, FUNCTION_1); // I2SO_DATA
+
+  I2S_CLK_ENABLE();
+  I2SIC = 0x3F;
+  I2SIE = 0;
+
+  // Reset I2S
+  I2SC &= ~(I2SRST);
+  I2SC |= I2SRST;
+  I2SC &= ~(I2SRST);
+
+  // FIFO mode 0 fed by DMA, both channels
+  I2SFC &= ~(I2SDE | (I2STXFMM << I2STXFM) | (I2SRXFMM << I2SRXFM));
+  I2SFC |= I2SDE;
+  I2SCC &= ~((I2STXCMM << I2STXCM) | (I2SRXCMM << I2SRXCM));
+
+  // Transmit master, right channel first, MSB first so every 32 bit word is sent from bit 31 to bit 0
+  I2SC &= ~(I2STSM | I2SRSM | (I2SBMM << I2SBM) | (I2SBDM << I2SBD) | (I2SCDM << I2SCD));
+  I2SC |= I2SRF | I2SMR | I2SRSM | I2SRMS | ((bitClockDiv & I2SBDM) << I2SBD) | ((clockDiv & I2SCDM) << I2SCD);
+
+  I2SC |= I2STXS;
+}
+
+void i2sDmaEnd()
+{
+  ETS_SLC_INTR_DISABLE();
+  SLCIE = 0;
+  SLCIC = 0xFFFFFFFF;
+
+  I2SC &= ~I2STXS;
+  SLCRXL |= SLCRXLE; // Stop the descriptor link
+  I2S_CLK_DISABLE();
+
+  bufferDoneCallback = nullptr;
+}
@@ -0,0 +1,225 @@
+#include "leap.h"
+#include "log.h"
+#include "ntp_client.h"
+#include "protocol.h"
+#include "frame_cache.h"
+
+#include "LittleFS.h"
+#include <sys/time.h>
+
+/**
+ * Leap seconds
+ *
+ * The wall clock (POSIX time) has no leap seconds, the minute before one simply lasts 61 seconds. They are known
+ * from LEAP_SECONDS_FILE (the list published by the IERS, updated with every new leap second) or from the leap
+ * indicator of the NTP servers. The frame of that minute gets an extra symbol (a bit 0 before the closing second),
+ * so the pulses of a transmission stay on the real timeline across it, and once the leap second has passed the
+ * clock is stepped back by one second.
+ */
+
+// Ends of the known leap seconds (UTC, full days), ascending
+static time_t leapTable[LeapTableSize];
+static uint8_t leapCount = 0;
+
+// The leap second which was taken out of the clock, and the clock at the last check
+static time_t applied = 0;
+static time_t lastSeen = 0;
+// The next time set is the step of a leap second, not a sync
+static bool leapStepPending = false;
+
+static time_t monthEnd(time_t t)
+{
+  tm utc;
+  time_t end = t - t % 86400;
+
+  do
+  {
+    end += 86400;
+    gmtime_r(&end, &utc);
+  } while (utc.tm_mday != 1);
+
+  return end;
+}
+
+// False if it is known already (or older than the whole table)
+static bool insertLeapSecond(time_t end)
+{
+  if (end % 86400 != 0)
+    return false;
+
+  for (uint8_t n = 0; n < leapCount; n++)
+    if (leapTable[n] == end)
+      return false;
+
+  // A full table keeps the latest ones
+  if (leapCount == LeapTableSize)
+  {
+    if (end < leapTable[0])
+      return false;
+    memmove(leapTable, leapTable + 1, (LeapTableSize - 1) * sizeof(leapTable[0]));
+    leapCount--;
+  }
+
+  uint8_t n = leapCount;
+  for (; n > 0 && leapTable[n - 1] > end; n--)
+    leapTable[n] = leapTable[n - 1];
+  leapTable[n] = end;
+  leapCount++;
+
+  return true;
+}
+
+void addLeapSecond(time_t end)
+{
+  // Cached frames around it were encoded without the announcement and the extra second
+  if (insertLeapSecond(end))
+    invalidateFrameCache();
+}
+
+void loadLeapSeconds()
+{
+  if (!LittleFS.exists(LEAP_SECONDS_FILE))
+    return;
+
+  File file = LittleFS.open(LEAP_SECONDS_FILE, "r");
+  if (!file)
+    return;
+
+  // Read line by line, the whole list has about 10 kB
+  long lastOffset = 0;
+  uint32_t expires = 0;
+  bool changed = false;
+  while (file.available())
+  {
+    const String line = file.readStringUntil('\n');
+    char *end;
+
+    if (line.startsWith("#@"))
+      expires = strtoul(line.c_str() + 2, nullptr, 10);
+    if (line[0] == '#')
+      continue;
+
+    const uint32_t ntpSeconds = strtoul(line.c_str(), &end, 10);
+    const long offset = strtol(end, nullptr, 10);
+    if (!ntpSeconds)
+      continue;
+
+    if (lastOffset && offset > lastOffset)
+      changed |= insertLeapSecond((time_t)(ntpSeconds - NtpUnixOffset));
+    else if (offset < lastOffset)
+      logWarn("negative leap seconds are not supported");
+    lastOffset = offset;
+  }
+  file.close();
+
+  if (changed)
+    invalidateFrameCache();
+
+  logInfo("leap seconds up to %u, the table expires at %u", leapCount ? (uint32_t)leapTable[leapCount - 1] : 0,
+          expires ? (uint32_t)(expires - NtpUnixOffset) : 0);
+}
+
+void ntpLeapIndicator(uint8_t leapIndicator, time_t now)
+{
+  static bool warned = false;
+
+  if (leapIndicator == 2 && !warned)
+  {
+    logWarn("negative leap seconds are not supported");
+    warned = true;
+  }
+
+  // Some servers keep the indicator for a while after the leap second
+  if (leapIndicator != 1 || (applied && now - applied < 86400))
+    return;
+
+  const time_t end = monthEnd(now);
+  if (nextLeapSecond(now) == end)
+    return;
+
+  addLeapSecond(end);
+  logInfo("NTP announces a leap second before %u", (uint32_t)end);
+}
+
+time_t nextLeapSecond(time_t now)
+{
+  for (uint8_t n = 0; n < leapCount; n++)
+    if (leapTable[n] > now)
+      return leapTable[n];
+
+  return 0;
+}
+
+bool leapSecondMinute(time_t minuteStart)
+{
+  for (uint8_t n = 0; n < leapCount; n++)
+    if (leapTable[n] - 60 == minuteStart)
+      return true;
+
+  return false;
+}
+
+bool leapSecondAnnounced(time_t minuteStart)
+{
+  const time_t end = nextLeapSecond(minuteStart);
+
+  return end && end - minuteStart <= LeapAnnounceSeconds;
+}
+
+bool leapSecondThisMonth(time_t minuteStart)
+{
+  const time_t end = nextLeapSecond(minuteStart);
+
+  // No month is longer than 31 days, the end of the month is only looked up if it can be the one
+  return end && end - minuteStart <= 31 * 86400L && end == monthEnd(minuteStart);
+}
+
+uint8_t frameSeconds(time_t minuteStart)
+{
+  return Protocol::FrameSeconds + leapSecondMinute(minuteStart);
+}
+
+uint8_t leapSecondsBefore(time_t t)
+{
+  const time_t now = time(nullptr);
+  uint8_t count = 0;
+
+  for (uint8_t n = 0; n < leapCount; n++)
+    if (leapTable[n] > now && leapTable[n] <= t && leapTable[n] != applied)
+      count++;
+
+  return count;
+}
+
+void serviceLeapSeconds()
+{
+  const time_t now = time(nullptr);
+
+  // Only a clock which was running right before the leap second, not one set afterwards
+  for (uint8_t n = 0; n < leapCount; n++)
+  {
+    const time_t end = leapTable[n];
+
+    if (end == applied || lastSeen >= end || now < end || now - lastSeen > 60)
+      continue;
+
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    tv.tv_sec -= 1;
+    leapStepPending = true;
+    settimeofday(&tv, nullptr);
+
+    applied = end;
+    logInfo("leap second inserted before %u", (uint32_t)end);
+  }
+
+  lastSeen = now;
+}
+
+bool takeLeapSecondStep()
+{
+  const bool step = leapStepPending;
+
+  leapStepPending = false;
+  return step;
+}
@@ -0,0 +1,234 @@
+#include "log.h"
+#include "web.h"
+#include "memory_stats.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+
+/**
+ * Deferred logging
+ *
+ * Serial.println() blocks for about 90 usec per character at 115200 baud, far too long next to the edge timer and
+ * right before a transmission. A log call therefore only copies the pointer to its format string (in flash), the
+ * arguments and the strings they point to (at most LogTextBytes together) into a RAM ring, with the interrupts off
+ * for those few instructions so it works from any context.
+ * serviceLog() formats the records at idle time and writes them to the serial port (never more than the UART FIFO
+ * takes), to the syslog server (UDP) and into a text tail served by GET /log.
+ */
+
+char syslogServer[40] = "";
+
+static LogRecord records[LogRecords];
+// head is written by logPush() with the interrupts off, tail only by serviceLog()
+static volatile uint32_t head = 0;
+static volatile uint32_t tail = 0;
+static volatile uint32_t dropped = 0;
+
+// The line being written, still waiting for room in the UART FIFO while pending
+static char line[LogLineLength + 3];
+static size_t lineLength = 0;
+static bool linePending = false;
+
+static char tailBuffer[LogTailBytes];
+static size_t tailPosition = 0;
+static bool tailWrapped = false;
+
+static WiFiUDP syslogUdp;
+static IPAddress syslogAddress;
+static bool syslogResolved = false;
+static unsigned long syslogResolveTime = 0;
+
+static const char levelLetters[] = "-EWID";
+// Syslog severity of every level (debug, error, warning, informational, debug)
+static const uint8_t syslogSeverities[] = {7, 3, 4, 6, 7};
+
+/**
+ * Append a string to the text of a record, returns where the next one starts. The last byte stays the terminator
+ * of a cut off string and of the ones which no longer fit.
+ */
+static uint8_t IRAM_ATTR copyText(char *text, uint8_t used, const char *string)
+{
+  if (string)
+    while (used < LogTextBytes - 1 && *string)
+      text[used++] = *string++;
+  text[used] = '\0';
+
+  return used < LogTextBytes - 1 ? used + 1 : used;
+}
+
+void IRAM_ATTR logPush(uint8_t level, PGM_P format, const uint32_t *args, uint8_t count, uint8_t strings)
+{
+  const uint32_t saved = xt_rsil(15);
+
+  if (head - tail == LogRecords)
+  {
+    dropped = dropped + 1;
+    xt_wsr_ps(saved);
+    return;
+  }
+
+  LogRecord &record = records[head & (LogRecords - 1)];
+  record.millis = millis();
+  record.format = format;
+  record.level = level;
+  record.strings = strings;
+
+  uint8_t used = 0;
+  for (uint8_t n = 0; n < LogMaxArgs; n++)
+  {
+    if (n < count && strings & (1 << n))
+    {
+      record.args[n] = used;
+      used = copyText(record.text, used, (const char *)(uintptr_t)args[n]);
+    }
+    else
+      record.args[n] = n < count ? args[n] : 0;
+  }
+
+  head = head + 1;
+  xt_wsr_ps(saved);
+}
+
+static void formatLine(uint8_t level, uint32_t time, PGM_P format, const uint32_t *args)
+{
+  int length = snprintf_P(line, LogLineLength + 1, PSTR("%lu.%03lu %c "), (unsigned long)(time / 1000),
+                          (unsigned long)(time % 1000), levelLetters[level]);
+
+  // Every argument is passed, the format only reads the ones it names
+  length += snprintf_P(line + length, LogLineLength + 1 - length, format, args[0], args[1], args[2], args[3],
+                       args[4], args[5]);
+  if (length > LogLineLength)
+    length = LogLineLength;
+
+  lineLength = length;
+}
+
+static void sendSyslog(uint8_t level)
+{
+  if (!syslogServer[0] || WiFi.status() != WL_CONNECTED)
+    return;
+
+  HeapScope heapScope(HeapLog);
+
+  // Resolved once, a DNS lookup per line would block
+  if (!syslogResolved)
+  {
+    if (syslogResolveTime && millis() - syslogResolveTime < SyslogResolveRetryMs)
+      return;
+    syslogResolveTime = millis();
+    syslogResolved = WiFi.hostByName(syslogServer, syslogAddress);
+    if (!syslogResolved)
+      return;
+  }
+
+  if (!syslogUdp.beginPacket(syslogAddress, SyslogPort))
+    return;
+  syslogUdp.printf("<%u>" HOSTNAME ": ", SyslogFacility * 8 + syslogSeverities[level]);
+  syslogUdp.write((const uint8_t *)line, lineLength);
+  syslogUdp.endPacket();
+}
+
+static void appendTail()
+{
+  for (size_t n = 0; n <= lineLength; n++)
+  {
+    tailBuffer[tailPosition] = n < lineLength ? line[n] : '\n';
+    if (++tailPosition == sizeof(tailBuffer))
+    {
+      tailPosition = 0;
+      tailWrapped = true;
+    }
+  }
+}
+
+/**
+ * Format the next record (or the count of the dropped ones behind it) into line and hand it to the syslog and
+ * the tail.
+ */
+static bool nextLine()
+{
+  if (tail != head)
+  {
+    const LogRecord &record = records[tail & (LogRecords - 1)];
+    uint32_t args[LogMaxArgs];
+
+    // The strings are formatted from the copies
+    for (uint8_t n = 0; n < LogMaxArgs; n++)
+      args[n] = record.strings & (1 << n) ? (uint32_t)(uintptr_t)(record.text + record.args[n]) : record.args[n];
+    formatLine(record.level, record.millis, record.format, args);
+    sendSyslog(record.level);
+    tail = tail + 1;
+  }
+  else
+  {
+    const uint32_t saved = xt_rsil(15);
+    const uint32_t lost = dropped;
+    dropped = 0;
+    xt_wsr_ps(saved);
+
+    if (!lost)
+      return false;
+
+    const uint32_t args[LogMaxArgs] = {lost};
+    formatLine(LogLevelWarn, millis(), PSTR("%u log records dropped"), args);
+    sendSyslog(LogLevelWarn);
+  }
+
+  appendTail();
+  return true;
+}
+
+static void handleLogGet()
+{
+  String body;
+
+  body.reserve(sizeof(tailBuffer));
+  if (tailWrapped)
+    body.concat(tailBuffer + tailPosition, sizeof(tailBuffer) - tailPosition);
+  body.concat(tailBuffer, tailPosition);
+
+  webServer.send(200, "text/plain", body);
+}
+
+void setupLog()
+{
+#if LOG_LEVEL > LogLevelNone
+  Serial.begin(115200);
+  Serial.println();
+#endif
+
+  webServer.on("/log", HTTP_GET, handleLogGet);
+}
+
+void serviceLog()
+{
+  for (uint8_t n = 0; n < LogDrainRecords; n++)
+  {
+    if (!linePending)
+    {
+      if (!nextLine())
+        return;
+      line[lineLength++] = '\r';
+      line[lineLength++] = '\n';
+      linePending = true;
+    }
+
+    // The rest waits for the next idle time instead of blocking on the UART
+    if ((size_t)Serial.availableForWrite() < lineLength)
+      return;
+
+    Serial.write((const uint8_t *)line, lineLength);
+    linePending = false;
+  }
+}
+
+void flushLog()
+{
+  while (linePending || tail != head || dropped)
+  {
+    serviceLog();
+    yield();
+  }
+
+  Serial.flush();
+}
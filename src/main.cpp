@@ -1,9 +1,9 @@
-#define DEBUG true
-
 /*
  Emulator DCF77
  Simulate a DCF77 radio receiver with a ESP8266, esp01 model
- Emits a complete three minute pulses train from the GPIO2 output
+ (MSF, WWVB and JJY can be selected at compile time with -D TIME_PROTOCOL=Msf/Wwvb/Jjy40/Jjy60)
+ Emits a complete three minute pulses train from the GPIO2 output (and from every further configured channel,
+ each one with its own time zone)
  the train is preceded by a single pulse at the lacking 59° pulse to allow some clock model synchronization
  of the beginning frame
  after the three pulses train one more single pulse is sent to safely close the frame
@@ -21,6 +21,7 @@
   so the time will be probably incorrect before at least 03:03 then dayLightSaving changes
  -the exact "second" precision is not guaranteed because of the simplicity of the NTP implementation
   normally the packet transit delay would be taken into account, but here is not
+  (now it is: ntp_client.cpp polls several servers and filters them as in RFC 5905)
 
  Fuso68 05/12/2015
 
@@ -49,8 +50,6 @@
  This code is in the public domain.
  */
 
-#include "LittleFS.h"
-
 #include <ESP8266WiFi.h>
 
 #include <DNSServer.h>
@@ -59,56 +58,40 @@
 #include <WiFiUdp.h>
 #include <ArduinoOTA.h>
 
-#include <WiFiManager.h>
-
-#include <ArduinoJson.h>
+#include <coredecls.h>
 
-#include <Ticker.h>
 #include "time.h"
 
-#define HOSTNAME "ESP-DCF77"
-
-char ntpServer[40] = "de.pool.ntp.org";
-char timezone[40] = "CET-1CEST,M3.5.0/02,M10.5.0/03"; // https://github.com/nayarsystems/posix_tz_db/blob/master/zones.csv
-int timeCorrectionOffset = 0; // Define a time correction offset in seconds
-
-// OTA settings
-unsigned int otaPort = 8266;
-char otaPassword[32] = ""; // Set OTA password via WiFi manager!
-
-const unsigned long checkInterval = 60000;
+#include "config.h"
+#include "channels.h"
+#include "scheduler.h"
+#include "meteo.h"
+#include "frame_cache.h"
+#include "web.h"
+#include "power.h"
+#include "schedule.h"
+#include "fleet.h"
+#include "sntp_server.h"
+#include "ntp_client.h"
+#include "leap.h"
+#include "memory_stats.h"
+#include "wifi_portal.h"
+#include "log.h"
+
+const unsigned long checkInterval = 1000;
 unsigned long lastCheck = 0;
 
-// Flag for saving data
-bool shouldSaveConfig = false;
-// Flag for starting on demand wifi config portal
-bool shouldStartConfigPortal = false;
-
-// Routine timer 100 msec
-Ticker dcfOutTimer;
-
-// #define DCF_OUT_PIN LED_BUILTIN
-#define DCF_OUT_PIN 2
-#define WIFI_PORTAL_PIN D5 // use this pin to manually trigger the wifi portal
-
-// How many total pulses we have
-// Three complete minutes + 2 head pulses and one tail pulse
-#define MaxPulseNumber 183
-#define FirstMinutePulseBegin 2
-#define SecondMinutePulseBegin 62
-#define ThirdMinutePulseBegin 122
+// A transmission is queued at most this long before its first pulse
+#define TransmissionPrepareUs 70000000LL
 
-// Complete array of pulses for three minutes
-// 0 = no pulse, 1=100msec, 2=200msec
-int pulseArray[MaxPulseNumber];
+// Wall clock time the last queued transmission ends
+time_t lastTransmissionEnd = 0;
 
-int pulseCount = 0;
-int dcfOutputOn = 0;
-int partialpulseCount = 0;
+#define WIFI_PORTAL_PIN Variant::PortalPin // use this pin to manually trigger the wifi portal
 
 void printLocalTime()
 {
-#ifdef DEBUG
+#if LOG_LEVEL >= LogLevelInfo
   time_t now;
   struct tm *timeinfo;
 
@@ -116,449 +99,82 @@ void printLocalTime()
   // timeinfo = gmtime(&now); // returns GMT time!
   timeinfo = localtime(&now);
 
-  // Serial.println(&timeinfo, "%A, %B %d %Y %H:%M:%S");
-  Serial.println(asctime(timeinfo));
-#endif
-}
-
-/**
- * Callback notifying us of the need to save config
- */
-void saveConfigCallback()
-{
-#ifdef DEBUG
-  Serial.println("Should save config");
-#endif
-
-  shouldSaveConfig = true;
-}
-
-void prepareFileSystem()
-{
-  // Clean FS, for testing
-  // LittleFS.format();
-
-  // Read configuration from FS json
-#ifdef DEBUG
-  Serial.println("mounting FS...");
-#endif
-
-  if (LittleFS.begin())
-  {
-#ifdef DEBUG
-    Serial.println("mounted file system");
-#endif
-
-    if (LittleFS.exists("/config.json"))
-    {
-      // File exists, reading and loading
-#ifdef DEBUG
-      Serial.println("reading config file");
-#endif
-
-      File configFile = LittleFS.open("/config.json", "r");
-      if (configFile)
-      {
-#ifdef DEBUG
-        Serial.println("opened config file");
-#endif
-
-        size_t size = configFile.size();
-        // Allocate a buffer to store contents of the file.
-        std::unique_ptr<char[]> buf(new char[size]);
-
-        configFile.readBytes(buf.get(), size);
-
-#if ARDUINOJSON_VERSION_MAJOR >= 6
-        DynamicJsonDocument json(1024);
-        auto deserializeError = deserializeJson(json, buf.get());
-        serializeJson(json, Serial);
-        if (!deserializeError)
-        {
-#else
-        DynamicJsonBuffer jsonBuffer;
-        JsonObject &json = jsonBuffer.parseObject(buf.get());
-        json.printTo(Serial);
-        if (json.success())
-        {
-#endif
-#ifdef DEBUG
-          Serial.println("\nparsed json");
-#endif
-
-          strcpy(ntpServer, json["ntpServer"]);
-          timeCorrectionOffset = json["timeCorrectionOffset"];
-          strcpy(timezone, json["timezone"]);
-          strcpy(otaPassword, json["otaPassword"]);
-          otaPort = json["otaPort"];
-        }
-        else
-        {
-#ifdef DEBUG
-          Serial.println("failed to load json config");
-#endif
-        }
-
-        configFile.close();
-      }
-    }
-  }
-  else
-  {
-    Serial.println("failed to mount FS");
-  }
-  //end read
-}
-
-void connectToWiFi()
-{
-  char otaPort_buffer[5];
-  itoa(otaPort, otaPort_buffer, 10);
-
-  char timeCorrectionOffset_buffer[5];
-  itoa(timeCorrectionOffset, timeCorrectionOffset_buffer, 10);
-
-  // The extra parameters to be configured (can be either global or just in the setup)
-  // After connecting, parameter.getValue() will get you the configured value
-  // id/name placeholder/prompt default length
-  WiFiManagerParameter custom_ntp_server("ntp server", "NTP Server", ntpServer, 40);
-  WiFiManagerParameter custom_timezone("timezone", "timezone", timezone, 40);
-  WiFiManagerParameter custom_timeCorrectionOffset("time correction offset", "time correction offset in seconds", timeCorrectionOffset_buffer, 5);
-  WiFiManagerParameter custom_ota_password("ota password", "OTA password", otaPassword, 32);
-  WiFiManagerParameter custom_ota_port("ota port", "OTA port", otaPort_buffer, 5);
-
-  // WiFiManager
-  // Local initialization. Once its business is done, there is no need to keep it around
-  WiFiManager wifiManager;
-
-  // Set config save notify callback
-  wifiManager.setSaveConfigCallback(saveConfigCallback);
-
-  wifiManager.addParameter(&custom_ntp_server);
-  wifiManager.addParameter(&custom_timezone);
-  wifiManager.addParameter(&custom_timeCorrectionOffset);
-  wifiManager.addParameter(&custom_ota_password);
-  wifiManager.addParameter(&custom_ota_port);
-
-  // Reset saved settings
-  // wifiManager.resetSettings();
-
-  // Sets timeout until configuration portal gets turned off. Useful to make it all retry or go to sleep in seconds.
-  wifiManager.setTimeout(180);
-
-#ifdef DEBUG
-  wifiManager.setDebugOutput(true);
-#else
-  wifiManager.setDebugOutput(false);
-#endif
-
-// Set WiFi DNS hostname
-#ifdef ESP8266
-  WiFi.hostname(HOSTNAME);
-#elif ESP32
-  WiFi.setHostname(HOSTNAME);
-#else
-#warning("Cannot set hostname for unknown chip (it is not a ESP8266 or ESP32!)")
-#endif
-
-  // Fetches ssid and pass from eeprom and tries to connect. If it does not connect it starts an access point with the specified name and goes into a blocking loop awaiting configuration.
-  if ((shouldStartConfigPortal && !wifiManager.startConfigPortal(HOSTNAME)) || !wifiManager.autoConnect(HOSTNAME))
-  {
-#ifdef DEBUG
-    Serial.println("failed to connect and hit timeout");
-#endif
-    delay(3000);
-    // Reset and try again, or maybe put it to deep sleep
-    ESP.reset();
-    delay(5000);
-  }
-
-  shouldStartConfigPortal = false;
-
-  //read updated parameters
-  strcpy(ntpServer, custom_ntp_server.getValue());
-  strcpy(timezone, custom_timezone.getValue());
-  strcpy(timeCorrectionOffset_buffer, custom_timeCorrectionOffset.getValue());
-  strcpy(otaPassword, custom_ota_password.getValue());
-  strcpy(otaPort_buffer, custom_ota_port.getValue());
-#ifdef DEBUG
-  Serial.println("The values in the file are: ");
-  Serial.println("\tntp server : " + String(ntpServer));
-  Serial.println("\ttimezone : " + String(timezone));
-  Serial.println("\ttime correction offset (sec) : " + String(timeCorrectionOffset_buffer));
-  Serial.println("\tota password : " + String(otaPassword));
-  Serial.println("\tota port : " + String(otaPort_buffer));
-#endif
-
-  // Save the custom parameters to FS
-  if (shouldSaveConfig)
-  {
-#ifdef DEBUG
-    Serial.println("saving config");
-#endif
-
-#if ARDUINOJSON_VERSION_MAJOR >= 6
-    DynamicJsonDocument json(1024);
-#else
-    DynamicJsonBuffer jsonBuffer;
-    JsonObject &json = jsonBuffer.createObject();
-#endif
-    json["ntpServer"] = ntpServer;
-    json["timezone"] = timezone;
-    json["timeCorrectionOffset"] = atoi(timeCorrectionOffset_buffer);
-    json["otaPassword"] = otaPassword;
-    json["otaPort"] = atoi(otaPort_buffer);
-
-    File configFile = LittleFS.open("/config.json", "w");
-    if (!configFile)
-    {
-#ifdef DEBUG
-      Serial.println("failed to open config file for writing");
-#endif
-    }
-
-#if ARDUINOJSON_VERSION_MAJOR >= 6
-#ifdef DEBUG
-    serializeJson(json, Serial);
-#endif
-    serializeJson(json, configFile);
-#else
-#ifdef DEBUG
-    json.printTo(Serial);
-#endif
-    json.printTo(configFile);
-#endif
-    configFile.close();
-    //end save
-  }
-
-#ifdef DEBUG
-  Serial.println("");
-  Serial.println("WiFi connected");
-  Serial.println("IP address: ");
-  Serial.println(WiFi.localIP());
+  // The fields are copied into the record, asctime() would return a buffer overwritten by the next call
+  logInfo("%04d-%02d-%02d %02d:%02d:%02d", timeinfo->tm_year + 1900, timeinfo->tm_mon + 1, timeinfo->tm_mday,
+          timeinfo->tm_hour, timeinfo->tm_min, timeinfo->tm_sec);
 #endif
 }
 
 /**
- * Called every 100 msec for DCF77 output
+ * The clock was synchronized: set (NTP step, fleet master, RTC estimate) or confirmed by an NTP update.
  */
-void dcfOut()
-{
-  if (dcfOutputOn == 1)
-  {
-    switch (partialpulseCount++)
-    {
-    case 0:
-      if (pulseArray[pulseCount] != 0)
-        digitalWrite(DCF_OUT_PIN, 0);
-      break;
-    case 1:
-      if (pulseArray[pulseCount] == 1)
-        digitalWrite(DCF_OUT_PIN, 1);
-      break;
-    case 2:
-      digitalWrite(DCF_OUT_PIN, 1);
-      break;
-    case 9:
-      if (pulseCount++ == (MaxPulseNumber - 1))
-      {
-        // One less because we FIRST tx the pulse THEN count it
-        pulseCount = 0;
-        dcfOutputOn = 0;
-      };
-
-      partialpulseCount = 0;
-      break;
-    };
-  };
-}
-
-int bin2Bcd(int dato)
-{
-  int msb, lsb;
-
-  if (dato < 10)
-    return dato;
-  msb = (dato / 10) << 4;
-  lsb = dato % 10;
-
-  return msb + lsb;
-}
-
-void calculateArray(int ArrayOffset, tm *timeinfo)
+void timeSynced()
 {
-  int n, Tmp, TmpIn;
-  int ParityCount = 0;
-
-  //first 20 bits are logical 0s
-  for (n = 0; n < 20; n++)
-    pulseArray[n + ArrayOffset] = 1;
-
-  //DayLightSaving bit
-  if (timeinfo->tm_isdst == 1)
-    pulseArray[17 + ArrayOffset] = 2;
-  else
-    pulseArray[18 + ArrayOffset] = 2;
-
-  //bit 20 must be 1 to indicate time active
-  pulseArray[20 + ArrayOffset] = 2;
-
-  //calculate minutes bits
-  TmpIn = bin2Bcd(timeinfo->tm_min);
-  for (n = 21; n < 28; n++)
-  {
-    Tmp = TmpIn & 1;
-    pulseArray[n + ArrayOffset] = Tmp + 1;
-    ParityCount += Tmp;
-    TmpIn >>= 1;
-  };
-  if ((ParityCount & 1) == 0)
-    pulseArray[28 + ArrayOffset] = 1;
-  else
-    pulseArray[28 + ArrayOffset] = 2;
-
-  //calculate hour bits
-  ParityCount = 0;
-  TmpIn = bin2Bcd(timeinfo->tm_hour);
-  for (n = 29; n < 35; n++)
-  {
-    Tmp = TmpIn & 1;
-    pulseArray[n + ArrayOffset] = Tmp + 1;
-    ParityCount += Tmp;
-    TmpIn >>= 1;
-  }
-  if ((ParityCount & 1) == 0)
-    pulseArray[35 + ArrayOffset] = 1;
-  else
-    pulseArray[35 + ArrayOffset] = 2;
-  ParityCount = 0;
-  //calculate day bits
-  TmpIn = bin2Bcd(timeinfo->tm_mday);
-  for (n = 36; n < 42; n++)
-  {
-    Tmp = TmpIn & 1;
-    pulseArray[n + ArrayOffset] = Tmp + 1;
-    ParityCount += Tmp;
-    TmpIn >>= 1;
-  }
-  //calculate weekday bits
-  TmpIn = bin2Bcd(timeinfo->tm_wday);
-  for (n = 42; n < 45; n++)
-  {
-    Tmp = TmpIn & 1;
-    pulseArray[n + ArrayOffset] = Tmp + 1;
-    ParityCount += Tmp;
-    TmpIn >>= 1;
-  }
-  //calculate month bits
-  TmpIn = bin2Bcd(timeinfo->tm_mon);
-  for (n = 45; n < 50; n++)
-  {
-    Tmp = TmpIn & 1;
-    pulseArray[n + ArrayOffset] = Tmp + 1;
-    ParityCount += Tmp;
-    TmpIn >>= 1;
-  }
-  //calculate year bits
-  TmpIn = bin2Bcd(timeinfo->tm_year - 2000);
-  for (n = 50; n < 58; n++)
-  {
-    Tmp = TmpIn & 1;
-    pulseArray[n + ArrayOffset] = Tmp + 1;
-    ParityCount += Tmp;
-    TmpIn >>= 1;
-  }
-  //date parity
-  if ((ParityCount & 1) == 0)
-    pulseArray[58 + ArrayOffset] = 1;
-  else
-    pulseArray[58 + ArrayOffset] = 2;
-
-  //last missing pulse
-  pulseArray[59 + ArrayOffset] = 0;
-
-#ifdef DEBUG
-  /* for debug: print the whole 180 secs array
-   * Serial.print(':');
-  for (n=0;n<60;n++)
-    Serial.print(pulseArray[n+ArrayOffset]);*/
-#endif
+  frameCacheTimeSet();
+  powerTimeSynced();
+  scheduleTimeSynced();
+  if (Variant::Fleet)
+    fleetTimeSynced();
+  if (Variant::SntpServer)
+    sntpServerTimeSynced();
 }
 
 void readAndDecodeTime()
 {
+  const BurstConfig burst = burstConfig;
   time_t now;
-  struct tm *timeinfo;
 
   time(&now);
-  timeinfo = localtime(&now);
-
-  // Add time correction offset e.g. if DCF77 is send a little bit to late and the clock is 1-2 minutes behind.
-  timeinfo->tm_sec += timeCorrectionOffset;
-  mktime(timeinfo);
-
-  // If we are over about the 56° second we risk to begin the pulses too late, so it's better
-  // to skip at the half of the next minute and NTP+recalculate all again
-  if (timeinfo->tm_sec > 56)
-  {
-    // delay(30000);
-    // Do a passive wait
-    lastCheck += 30000;
-
+  if (now < MinValidTime || !burstAllowed())
     return;
-  }
-
-  // Calculate bis array for the first minute
-  calculateArray(FirstMinutePulseBegin, timeinfo);
-
-  // Add one minute and calculate array again for the second minute
-  timeinfo->tm_min += 1;
-  mktime(timeinfo);
 
-  calculateArray(SecondMinutePulseBegin, timeinfo);
+  // A clock stepped back must not hold the next transmission for long
+  if (lastTransmissionEnd > now + 3600)
+    lastTransmissionEnd = 0;
 
-  // One minute more for the third minute
-  timeinfo->tm_min += 1;
-  mktime(timeinfo);
+  // The first frame starts with a minute, its head pulses in the seconds before. Keep the idle gap after the
+  // previous transmission, and if we are too late for a minute (also respecting channels which lead their
+  // pulses), it's better to take the next one
+  time_t firstFrame = now > lastTransmissionEnd + burst.gapSeconds ? now : lastTransmissionEnd + burst.gapSeconds;
+  firstFrame += burst.headPulses + 59;
+  firstFrame -= firstFrame % 60;
 
-  calculateArray(ThirdMinutePulseBegin, timeinfo);
+  // A scheduled wake up waits for its burst (the RTC clock may have woken us a little early)
+  if (firstFrame < scheduledFirstFrame())
+    firstFrame = scheduledFirstFrame();
 
-  // How much seconds to the minute's end?
-  // Don't forget that we begin transmission at second 58°
-  int SkipSeconds = 58 - timeinfo->tm_sec;
-  delay(SkipSeconds * 1000);
+  // A leap second ahead is not in the wall clock yet, the frames get longer by it
+  uint64_t startMicros = wallClockToMicros(firstFrame - burst.headPulses) + leapSecondsBefore(firstFrame) * 1000000ULL;
+  if ((int64_t)(startMicros - micros64()) < MaxEdgeOffsetUs + MinTransmissionLeadUs)
+  {
+    firstFrame += 60;
+    startMicros += 60000000ULL;
+  }
 
-  // DCF begin
-  dcfOutputOn = 1;
-
-  // Three minutes are needed to transmit all the packet and
-  // then wait more 30 secs to locate safely at the half of minute.
-  // NB 150+60=210sec, 60secs are lost from main routine.
-  delay(150000);
-  // Do a passive wait
-  // lastCheck += millis() + 150000;
-}
+  // Not queued too early, the time might still be corrected by NTP
+  if ((int64_t)(startMicros - micros64()) > TransmissionPrepareUs)
+    return;
 
-void setupDcf()
-{
-  // DCF output pin
-  pinMode(DCF_OUT_PIN, OUTPUT);
-  digitalWrite(DCF_OUT_PIN, LOW);
+  // Prepared while no interrupt reads it, the edge scheduler takes it over once queued
+  Transmission *transmission = reserveTransmission();
+  if (!transmission)
+    return;
 
-  // Handle DCF pulses
-  dcfOutTimer.attach_ms(100, dcfOut);
+  printLocalTime();
 
-  // First 2 pulses: 1 + blank to simulate the packet beginning
-  pulseArray[0] = 1;
-  // Missing pulse indicates start of minute
-  pulseArray[1] = 0;
+  // All channels share the same timebase, each channel encodes the minutes in its own time zone
+  // (normally they are ready in the frame cache)
+  for (uint8_t n = 0; n < channelCount; n++)
+    calculateArray(channels[n], firstFrame, burst, transmission->pulses[n]);
 
-  // Last pulse after the third 59° blank
-  pulseArray[MaxPulseNumber - 1] = 1;
+  // DCF begin
+  transmission->startMicros = startMicros;
+  transmission->pulseCount = burstPulseCount(burst, firstFrame);
+  queueTransmission();
 
-  pulseCount = 0;
-  dcfOutputOn = 0; //we begin with the output OFF
+  // The edge scheduler drives the output in the background, the next transmission follows after the gap
+  lastTransmissionEnd = firstFrame - burst.headPulses + transmission->pulseCount;
+  burstQueued(firstFrame);
 }
 
 void setupOta()
@@ -572,82 +188,165 @@ void setupOta()
   // No authentication by default
   ArduinoOTA.setPassword((const char *)otaPassword);
 
-#ifdef DEBUG
   ArduinoOTA.onStart([]()
-                     { Serial.println("Start"); });
+                     { logInfo("OTA start"); });
   ArduinoOTA.onEnd([]()
-                   { Serial.println("\nEnd"); });
+                   {
+                     logInfo("OTA end");
+                     flushConfig();
+                     flushLog();
+                   });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total)
-                        { Serial.printf("Progress: %u%%\r", (progress / (total / 100))); });
+                        {
+                          // The update blocks loop(), only every tenth percent is logged and written out
+                          static unsigned int lastTenth = 0;
+                          const unsigned int tenth = progress / (total / 10);
+                          if (tenth != lastTenth)
+                          {
+                            lastTenth = tenth;
+                            logDebug("OTA progress: %u%%", tenth * 10);
+                            serviceLog();
+                          }
+                        });
   ArduinoOTA.onError([](ota_error_t error)
                      {
-                       Serial.printf("Error[%u]: ", error);
-                       if (error == OTA_AUTH_ERROR)
-                         Serial.println("Auth Failed");
-                       else if (error == OTA_BEGIN_ERROR)
-                         Serial.println("Begin Failed");
-                       else if (error == OTA_CONNECT_ERROR)
-                         Serial.println("Connect Failed");
-                       else if (error == OTA_RECEIVE_ERROR)
-                         Serial.println("Receive Failed");
-                       else if (error == OTA_END_ERROR)
-                         Serial.println("End Failed");
+                       static const char *const errors[] = {"Auth", "Begin", "Connect", "Receive", "End"};
+                       logError("OTA error[%u]: %s Failed", error, error <= OTA_END_ERROR ? errors[error] : "");
                      });
-#endif
   ArduinoOTA.begin();
 }
 
+/**
+ * Answer OTA invitations, ArduinoOTA only listens when polled. Not after a scheduled wake up, the radio stays off.
+ */
+void serviceOta()
+{
+  if (Variant::Ota && !scheduledWake())
+    ArduinoOTA.handle();
+}
+
 void setup()
 {
-#ifdef DEBUG
-  Serial.begin(115200);
-  Serial.println();
-  Serial.println("INIT DCF77 emulator");
-#endif
+  setupLog();
+  logInfo("INIT DCF77 emulator (%s, %s firmware)", Protocol::Name, Variant::Name);
+  // After a scheduled deep sleep the config comes from the RTC memory, no LittleFS and WiFiManager
+  const bool resumed = resumeFromDeepSleep();
+  if (!resumed)
+  {
+    prepareFileSystem();
+    if (Variant::Meteo)
+      setupMeteo();
+    loadLeapSeconds();
+  }
+
   /*** DCF ***/
   setupDcf();
 
+  /*** NTP time ***/
+  settimeofday_cb([]()
+                  {
+                    // The clock stepped back over a leap second or slewed by the NTP client is no sync: power save,
+                    // the schedule and the SNTP server keep their state, the frames are still valid
+                    if (takeLeapSecondStep() || takeNtpSlewStep())
+                      return;
+
+                    timeSynced();
+                  });
+  // NTP updates which do not step the clock
+  setNtpSyncCallback(timeSynced);
+
+  /*** NTP client ***/
+  setupNtpClient();
+
+  /*** HTTP ***/
+  // Before the WiFi, the config portal takes over port 80 while it is open
+  setupWebServer();
+
+  /*** Live config changes (PUT /config, config portal) ***/
+  setConfigChangedCallback([](uint8_t changes)
+                           {
+                             if (changes & ConfigTimezone)
+                               setTZ(channels[0].timezone);
+                             // Frames encoded with the old settings are stale
+                             if (changes & (ConfigTimezone | ConfigFrames))
+                               invalidateFrameCache();
+                             if (changes & ConfigNtpServers)
+                               loadNtpServers();
+                             if (Variant::Ota && (changes & ConfigOta))
+                             {
+                               ArduinoOTA.end();
+                               setupOta();
+                             }
+                           });
+  setupConfigService();
+
   /*** WIFI ***/
   // Wifi portal trigger pin
-  pinMode(WIFI_PORTAL_PIN, INPUT_PULLUP);
+  if (Variant::PortalButton)
+    pinMode(WIFI_PORTAL_PIN, INPUT_PULLUP);
+
+  if (resumed)
+  {
+    quickSync();
+  }
+  else
+  {
+    setupWiFi();
 
-  prepareFileSystem();
-  connectToWiFi();
+    /*** OTA ***/
+    if (Variant::Ota)
+      setupOta();
 
-  /*** OTA ***/
-  setupOta();
+    // The time comes from the own NTP client (fleet followers take it from the master)
+    setTZ(channels[0].timezone);
+  }
+
+  /*** Power ***/
+  setupPower();
+  setupMemoryStats();
 
-  /*** NTP time ***/
-  // Get time from NTP server
-  // configTime(gmtOffset_sec, daylightOffset_sec, ntpServer);
-  configTime(timezone, ntpServer);
-#ifdef DEBUG
   printLocalTime();
-#endif
 }
 
 void loop()
 {
-  if (WiFi.status() != WL_CONNECTED)
+  if (Variant::PortalButton && digitalRead(WIFI_PORTAL_PIN) == LOW)
   {
-    connectToWiFi();
+    wakeRadio();
+    startConfigPortal();
   }
-  else if (digitalRead(WIFI_PORTAL_PIN) == LOW)
-  {
-    shouldStartConfigPortal = true;
 
-    connectToWiFi();
-  }
+  // In power save mode the radio is off between the NTP syncs, a scheduled wake up sends without WiFi
+  if (radioEnabled() && !scheduledWake())
+    serviceWiFi();
+
+  // First, the packets are timestamped when they are seen
+  serviceNtpClient();
+  if (Variant::SntpServer)
+    serviceSntpServer();
+  handleWebServer();
+  serviceOta();
+  serviceLeapSeconds();
 
   // Async wait without using blocking "delay"
   if ((millis() - lastCheck) > checkInterval)
   {
     lastCheck = millis();
 
-#ifdef DEBUG
-    printLocalTime();
-#endif
-
     readAndDecodeTime();
   }
+  else
+  {
+    // Idle time: encode the following minutes ahead (except the channels a fleet follower receives them for)
+    serviceFrameCache();
+  }
+
+  if (Variant::Fleet)
+    serviceFleet();
+
+  serviceMemoryStats();
+  serviceConfig();
+  serviceLog();
+  servicePower();
+  serviceSchedule();
 }
@@ -0,0 +1,147 @@
+#include "memory_stats.h"
+#include "log.h"
+#include "web.h"
+
+#include <ArduinoJson.h>
+
+/**
+ * Heap and stack statistics
+ *
+ * Long uptimes fail on a fragmented heap rather than on an empty one, so besides the free heap the largest free
+ * block and the fragmentation are tracked. malloc(), calloc() and realloc() are wrapped by the linker
+ * (-Wl,--wrap, see platformio.ini), the wrappers count every allocation for the subsystem of the innermost
+ * HeapScope; new and String allocate through them as well. A freed block cannot be told apart without its size,
+ * so what a subsystem keeps is measured as the change of the free heap over its scopes. The stack high water mark
+ * of loop() comes from the painted continuation stack, the one of the SYS stack is sampled by the edge interrupt.
+ */
+
+struct OwnerStats
+{
+  uint32_t allocations;
+  uint32_t bytes;    // requested in total
+  uint32_t largest;  // largest single request
+  uint32_t failures; // requests which found no block large enough
+  int32_t retained;  // change of the free heap over all scopes, negative if it freed more than it allocated
+};
+
+static const char *const ownerNames[HeapOwners] = {"other", "wifi", "web", "config", "ntp", "log", "fleet"};
+
+static OwnerStats ownerStats[HeapOwners];
+static HeapOwner currentOwner = HeapOther;
+
+uint32_t interruptStackLow = UINT32_MAX;
+static uint32_t lowestFreeHeap = UINT32_MAX;
+static unsigned long lastLog = 0;
+
+// Called from IRAM code of the core (and possibly from interrupts), so it stays in IRAM and only counts
+static inline __attribute__((always_inline)) void countAllocation(size_t size, const void *block)
+{
+  OwnerStats &stats = ownerStats[currentOwner];
+
+  stats.allocations++;
+  stats.bytes += size;
+  if (size > stats.largest)
+    stats.largest = size;
+  if (!block && size)
+    stats.failures++;
+}
+
+extern "C"
+{
+  void *__real_malloc(size_t size);
+  void *__real_calloc(size_t count, size_t size);
+  void *__real_realloc(void *pointer, size_t size);
+
+  void *IRAM_ATTR __wrap_malloc(size_t size)
+  {
+    void *block = __real_malloc(size);
+    countAllocation(size, block);
+    return block;
+  }
+
+  void *IRAM_ATTR __wrap_calloc(size_t count, size_t size)
+  {
+    void *block = __real_calloc(count, size);
+    countAllocation(count * size, block);
+    return block;
+  }
+
+  void *IRAM_ATTR __wrap_realloc(void *pointer, size_t size)
+  {
+    void *block = __real_realloc(pointer, size);
+    countAllocation(size, block);
+    return block;
+  }
+}
+
+HeapScope::HeapScope(HeapOwner owner) : previous(currentOwner), freeHeap(ESP.getFreeHeap())
+{
+  currentOwner = owner;
+}
+
+HeapScope::~HeapScope()
+{
+  const uint32_t now = ESP.getFreeHeap();
+
+  ownerStats[currentOwner].retained += (int32_t)(freeHeap - now);
+  if (now < lowestFreeHeap)
+    lowestFreeHeap = now;
+  currentOwner = previous;
+}
+
+static uint32_t interruptStackUsed()
+{
+  return interruptStackLow == UINT32_MAX ? 0 : SysStackTop - interruptStackLow;
+}
+
+static void handleStatusGet()
+{
+  DynamicJsonDocument json(1536);
+  String body;
+
+  json["uptimeSeconds"] = millis() / 1000;
+  json["freeHeap"] = ESP.getFreeHeap();
+  json["lowestFreeHeap"] = lowestFreeHeap;
+  json["maxFreeBlock"] = ESP.getMaxFreeBlockSize();
+  json["fragmentation"] = ESP.getHeapFragmentation();
+  json["loopStackFree"] = ESP.getFreeContStack();
+  json["interruptStackUsed"] = interruptStackUsed();
+
+  JsonObject owners = json.createNestedObject("heapOwners");
+  for (uint8_t n = 0; n < HeapOwners; n++)
+  {
+    const OwnerStats &stats = ownerStats[n];
+    JsonObject entry = owners.createNestedObject(ownerNames[n]);
+
+    entry["allocations"] = stats.allocations;
+    entry["bytes"] = stats.bytes;
+    entry["largest"] = stats.largest;
+    entry["failures"] = stats.failures;
+    entry["retained"] = stats.retained;
+  }
+
+  serializeJson(json, body);
+  webServer.send(200, "application/json", body);
+}
+
+void setupMemoryStats()
+{
+  lastLog = millis();
+  webServer.on("/status", HTTP_GET, handleStatusGet);
+}
+
+void serviceMemoryStats()
+{
+  const uint32_t freeHeap = ESP.getFreeHeap();
+
+  if (freeHeap < lowestFreeHeap)
+    lowestFreeHeap = freeHeap;
+
+  if (millis() - lastLog < MemoryLogIntervalMs)
+    return;
+  lastLog = millis();
+
+  logInfo("memory: %u B free (lowest %u), largest block %u, %u%% fragmented, stack %u B free, interrupt %u B used",
+          freeHeap, lowestFreeHeap, ESP.getMaxFreeBlockSize(), ESP.getHeapFragmentation(), ESP.getFreeContStack(),
+          interruptStackUsed());
+}
@@ -0,0 +1,150 @@
+#include "meteo.h"
+#include "config.h"
+#include "log.h"
+#include "protocol.h"
+#include "variant.h"
+#include "web.h"
+
+#include "LittleFS.h"
+
+/**
+ * Meteotime / civil warning payload
+ *
+ * DCF77 uses bits 1..14 of every minute for third party data, Meteotime spreads one encrypted weather block of
+ * 42 bits over three minutes. The emulator does not create this data, it only passes it on: blocks are read from
+ * METEO_FILE at boot or posted to /meteo, queued per UTC minute and patched into the frames as they are encoded.
+ * Minutes without payload keep the bits at 0.
+ */
+
+struct MeteoMinute
+{
+  time_t minute; // UTC time of the minute marker, 0 = free slot
+  uint16_t bits; // bit n is transmitted as frame bit 1 + n
+};
+
+static MeteoMinute meteoQueue[MeteoQueueMinutes];
+
+static MeteoMinute *meteoSlot(time_t minute)
+{
+  MeteoMinute *oldest = &meteoQueue[0];
+
+  for (uint8_t n = 0; n < MeteoQueueMinutes; n++)
+  {
+    if (meteoQueue[n].minute == minute)
+      return &meteoQueue[n];
+    if (meteoQueue[n].minute < oldest->minute)
+      oldest = &meteoQueue[n];
+  }
+
+  // A free slot has minute 0 and is the oldest anyway
+  return oldest;
+}
+
+int queueMeteoBits(time_t firstMinute, const char *bits)
+{
+  const size_t length = strlen(bits);
+
+  if (Protocol::PayloadBits == 0 || length == 0 || length % Protocol::PayloadBits != 0 || firstMinute <= 0)
+    return 0;
+  if (strspn(bits, "01") != length)
+    return 0;
+
+  firstMinute -= firstMinute % 60;
+
+  const int minutes = length / Protocol::PayloadBits;
+  for (int n = 0; n < minutes; n++)
+  {
+    MeteoMinute *slot = meteoSlot(firstMinute + n * 60);
+
+    slot->minute = firstMinute + n * 60;
+    slot->bits = 0;
+    for (uint8_t bit = 0; bit < Protocol::PayloadBits; bit++)
+    {
+      if (bits[n * Protocol::PayloadBits + bit] == '1')
+        slot->bits |= 1 << bit;
+    }
+  }
+
+  return minutes;
+}
+
+int queueMeteoLines(const char *text)
+{
+  int minutes = 0;
+
+  while (*text)
+  {
+    char line[128];
+    const size_t length = strcspn(text, "\r\n");
+
+    if (length < sizeof(line))
+    {
+      char bits[sizeof(line)];
+      long long firstMinute;
+
+      memcpy(line, text, length);
+      line[length] = 0;
+
+      if (sscanf(line, "%lld %127s", &firstMinute, bits) == 2)
+        minutes += queueMeteoBits((time_t)firstMinute, bits);
+    }
+
+    text += length;
+    text += strspn(text, "\r\n");
+  }
+
+  return minutes;
+}
+
+void applyMeteoBits(uint8_t *symbols, time_t frameStart)
+{
+  if (Protocol::PayloadBits == 0 || !Variant::Meteo)
+    return;
+
+  for (uint8_t n = 0; n < MeteoQueueMinutes; n++)
+  {
+    if (meteoQueue[n].minute != frameStart)
+      continue;
+
+    // DCF77 symbols: 1 = bit 0, 2 = bit 1
+    for (uint8_t bit = 0; bit < Protocol::PayloadBits; bit++)
+      symbols[1 + bit] = ((meteoQueue[n].bits >> bit) & 1) + 1;
+
+    return;
+  }
+}
+
+static void loadMeteoFile()
+{
+  if (!LittleFS.exists(METEO_FILE))
+    return;
+
+  File file = LittleFS.open(METEO_FILE, "r");
+  if (!file)
+    return;
+
+  const String text = file.readString();
+  file.close();
+
+  const int minutes = queueMeteoLines(text.c_str());
+  logInfo("queued %d payload minutes from " METEO_FILE, minutes);
+}
+
+static void handleMeteoPost()
+{
+  const int minutes = queueMeteoLines(webServer.arg("plain").c_str());
+
+  if (minutes == 0)
+  {
+    webServer.send(400, "text/plain", "Expected lines of \"<UTC epoch> <bits>\"");
+    return;
+  }
+
+  webServer.send(200, "text/plain", String(minutes) + " minutes queued");
+}
+
+void setupMeteo()
+{
+  loadMeteoFile();
+  webServer.on("/meteo", HTTP_POST, handleMeteoPost);
+}
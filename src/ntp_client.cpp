@@ -0,0 +1,469 @@
+#include "ntp_client.h"
+#include "ntp_packet.h"
+#include "config.h"
+#include "fleet.h"
+#include "frame_cache.h"
+#include "leap.h"
+#include "memory_stats.h"
+#include "web.h"
+#include "log.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <ArduinoJson.h>
+#include <lwip/dns.h>
+#include <sys/time.h>
+
+/**
+ * NTP client
+ *
+ * Instead of the SNTP client of the SDK (one server, no filtering) all configured servers are polled at once
+ * from one UDP socket. Every answer gives offset and round trip delay (RFC 5905: T1 sent, T2 received and T3 sent
+ * by the server, T4 received; see ntp_packet.cpp), the samples go through the clock filter of their server, and
+ * once all answers are in (or timed out) the intersection and cluster algorithms pick the servers which agree, see
+ * ntp_select.cpp.
+ * Their combined offset steps the clock only on the first update and when it is large, otherwise it is slewed or,
+ * within the jitter, left alone, see ntp_discipline.cpp. The server names are resolved by lwIP in the background,
+ * a lookup never blocks loop().
+ */
+
+char ntpServers[NtpMaxServers - 1][40];
+
+struct Server
+{
+  char name[40];
+  uint16_t port;
+  IPAddress address;
+  bool resolved;
+  bool resolving;       // lookup in progress, nameResolved() is called back
+  unsigned long resolveTime;
+  bool pending;         // polled, no answer yet
+  NtpRequest request;   // of the last poll
+  uint8_t reach;        // shift register of the last 8 polls, 1 = answered
+  uint32_t sent;
+  uint32_t received;
+  uint32_t rejected;    // malformed, unsynchronized or not matching the request
+};
+
+static Server servers[NtpMaxServers];
+// Clock filters, in their own array for the selection
+static NtpPeer peers[NtpMaxServers];
+static uint8_t serverCount = 0;
+
+static WiFiUDP ntpUdp;
+static bool listening = false;
+static uint8_t packet[NtpPacketBytes];
+
+static bool polling = false;
+static bool pollRequested = true;
+static unsigned long pollStart = 0;
+static unsigned long lastPoll = 0;
+static uint8_t burstLeft = NtpBurstPolls;
+
+static bool synced = false;
+
+// Poll interval, drift of the local clock and the slew in progress
+static NtpDiscipline discipline;
+static uint64_t lastSlewMicros = 0;
+// The next time set is a slew step, not a sync
+static bool slewStepPending = false;
+static NtpSyncCallback syncCallback = nullptr;
+static NtpSelection selection;
+static time_t lastUpdate = 0;
+// System peer of the last update, what the SNTP server announces
+static SntpUpstream upstream = {0, 0, 0, 0};
+
+static int64_t wallClockUs()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static void addServer(const char *text)
+{
+  if (!text[0] || serverCount >= NtpMaxServers)
+    return;
+
+  Server &server = servers[serverCount];
+  const char *colon = strchr(text, ':');
+  const size_t length = colon ? (size_t)(colon - text) : strlen(text);
+
+  memset(&server, 0, sizeof(server));
+  strlcpy(server.name, text, min(length + 1, sizeof(server.name)));
+  server.port = colon ? atoi(colon + 1) : NtpPort;
+  clearNtpPeer(peers[serverCount]);
+  serverCount++;
+}
+
+void loadNtpServers()
+{
+  serverCount = 0;
+  addServer(ntpServer);
+  for (uint8_t n = 0; n < NtpMaxServers - 1; n++)
+    addServer(ntpServers[n]);
+
+  // A single pool name: query its numbered pools, each resolves to other servers
+  const char *pool = strstr(ntpServer, "pool.ntp.org");
+  if (serverCount == 1 && pool && !isdigit(ntpServer[0]) && !strchr(ntpServer, ':'))
+  {
+    char name[40];
+
+    serverCount = 0;
+    for (uint8_t n = 0; n < NtpMaxServers; n++)
+    {
+      snprintf(name, sizeof(name), "%u.%s", n, ntpServer);
+      addServer(name);
+    }
+  }
+
+  polling = false;
+  pollRequested = true;
+  burstLeft = NtpBurstPolls;
+}
+
+/**
+ * Answer of lwIP to a lookup, null if it failed. Called from the network stack, not from loop().
+ */
+static void nameResolved(const char *name, const ip_addr_t *address, void *arg)
+{
+  Server &server = servers[(uintptr_t)arg];
+
+  // The server list may have been reloaded meanwhile
+  if (!server.resolving || strcmp(name, server.name) != 0)
+    return;
+
+  server.resolving = false;
+  if (address)
+  {
+    server.address = IPAddress(address);
+    server.resolved = true;
+  }
+  else
+    logWarn("cannot resolve NTP server %s", server.name);
+}
+
+static void resolveServer(uint8_t n)
+{
+  Server &server = servers[n];
+  ip_addr_t address;
+
+  // A lookup not answered until the retry is given up
+  server.resolveTime = millis();
+  server.resolving = false;
+
+  // Addresses and names in the cache of lwIP are answered right away
+  const err_t result = dns_gethostbyname(server.name, &address, nameResolved, (void *)(uintptr_t)n);
+  if (result == ERR_OK)
+  {
+    server.address = IPAddress(&address);
+    server.resolved = true;
+  }
+  else if (result == ERR_INPROGRESS)
+    server.resolving = true;
+  else
+    logWarn("cannot resolve NTP server %s", server.name);
+}
+
+static void sendPolls()
+{
+  for (uint8_t n = 0; n < serverCount; n++)
+  {
+    Server &server = servers[n];
+
+    server.reach <<= 1;
+    server.pending = false;
+
+    // Resolved once, in the background: the server takes part from the first poll after the answer
+    if (!server.resolved)
+    {
+      if (!server.resolveTime || millis() - server.resolveTime >= NtpResolveRetryMs)
+        resolveServer(n);
+      if (!server.resolved)
+        continue;
+    }
+
+    // The transmit timestamp is the local clock at sending (T1)
+    if (!ntpUdp.beginPacket(server.address, server.port))
+      continue;
+    buildNtpRequest(packet, wallClockUs(), server.request);
+    ntpUdp.write(packet, sizeof(packet));
+    if (!ntpUdp.endPacket())
+      continue;
+
+    server.pending = true;
+    server.sent++;
+  }
+
+  polling = true;
+  pollStart = millis();
+}
+
+static Server *pendingServer(IPAddress address, uint16_t port)
+{
+  for (uint8_t n = 0; n < serverCount; n++)
+    if (servers[n].pending && servers[n].address == address && servers[n].port == port)
+      return &servers[n];
+
+  return nullptr;
+}
+
+static void receiveAnswers()
+{
+  while (ntpUdp.parsePacket() > 0)
+  {
+    const int64_t receivedUs = wallClockUs();
+    const uint64_t nowMicros = micros64();
+    Server *server = pendingServer(ntpUdp.remoteIP(), ntpUdp.remotePort());
+
+    if (!server)
+      continue;
+    server->pending = false;
+
+    NtpAnswer answer;
+    const int length = ntpUdp.read(packet, sizeof(packet));
+    if (length <= 0 || !parseNtpAnswer(packet, length, server->request, receivedUs, nowMicros, answer))
+    {
+      server->rejected++;
+      continue;
+    }
+
+    NtpPeer &peer = peers[server - servers];
+    peer.stratum = answer.stratum;
+    peer.leap = answer.leap;
+    peer.rootDelayUs = answer.rootDelayUs;
+    peer.rootDispersionUs = answer.rootDispersionUs;
+    addNtpSample(peer, answer.sample, nowMicros);
+
+    server->reach |= 1;
+    server->received++;
+  }
+}
+
+static bool answersPending()
+{
+  for (uint8_t n = 0; n < serverCount; n++)
+    if (servers[n].pending)
+      return true;
+
+  return false;
+}
+
+/**
+ * Valid peer with the least delay, -1 if there is none.
+ */
+static int8_t nearestPeer()
+{
+  int8_t nearest = -1;
+
+  for (uint8_t n = 0; n < serverCount; n++)
+    if (peers[n].valid && (nearest < 0 || peers[n].delayUs < peers[nearest].delayUs))
+      nearest = n;
+
+  return nearest;
+}
+
+/**
+ * Step the clock by offsetUs.
+ */
+static void setClock(int64_t offsetUs)
+{
+  const int64_t corrected = wallClockUs() + offsetUs;
+  const struct timeval tv = {(time_t)(corrected / 1000000LL), (suseconds_t)(corrected % 1000000LL)};
+
+  // The samples were taken against the old clock
+  for (uint8_t n = 0; n < serverCount; n++)
+    shiftNtpPeer(peers[n], offsetUs);
+
+  settimeofday(&tv, nullptr);
+}
+
+static void slewClock()
+{
+  const uint64_t now = micros64();
+  const int64_t stepUs = nextNtpSlewStep(discipline, now - lastSlewMicros);
+
+  if (!stepUs)
+    return;
+
+  lastSlewMicros = now;
+  slewStepPending = true;
+  setClock(stepUs);
+}
+
+static void updateClock()
+{
+  polling = false;
+  for (uint8_t n = 0; n < serverCount; n++)
+    servers[n].pending = false;
+
+  if (!selectNtpPeers(peers, serverCount, micros64(), &selection))
+  {
+    if (time(nullptr) < MinValidTime && nearestPeer() >= 0)
+    {
+      // Any answer beats a clock in 1970, the filters refine it with the following polls
+      logInfo("clock set from NTP server %s", servers[nearestPeer()].name);
+      setClock(peers[nearestPeer()].offsetUs);
+      lastUpdate = time(nullptr);
+    }
+    else
+      logDebug("no majority of the NTP servers agrees yet");
+    return;
+  }
+
+  const int64_t offsetUs = selection.offsetUs;
+  const uint8_t exponent = discipline.pollExponent;
+  const NtpCorrection correction = updateNtpDiscipline(discipline, offsetUs, selection.jitterUs, micros64());
+
+  synced = true;
+  burstLeft = 0;
+  if (discipline.pollExponent != exponent)
+    logInfo("NTP poll interval %u s: offset %d us, drift %d ppb, jitter %d us", 1U << discipline.pollExponent,
+            (int32_t)offsetUs, (int32_t)(discipline.frequencyPpm * 1000), (int32_t)selection.jitterUs);
+  logDebug("NTP: offset %d us, jitter %d us, %u of %u servers selected", (int32_t)offsetUs,
+           (int32_t)selection.jitterUs, selection.survivorCount, serverCount);
+
+  if (selection.systemPeer >= 0)
+  {
+    const NtpPeer &peer = peers[selection.systemPeer];
+
+    // System variables of RFC 5905 11.2: root delay and dispersion over the system peer
+    upstream.stratum = peer.stratum;
+    upstream.address = (uint32_t)servers[selection.systemPeer].address;
+    upstream.rootDelayUs = peer.rootDelayUs + peer.delayUs;
+    upstream.rootDispersionUs = peer.rootDispersionUs + peer.dispersionUs + selection.jitterUs;
+  }
+
+  // Only a step sets the time, the settimeofday() callback reports the sync then
+  if (correction == NtpStep)
+    setClock(offsetUs);
+  else
+  {
+    lastSlewMicros = micros64();
+    if (syncCallback)
+      syncCallback();
+  }
+  lastUpdate = time(nullptr);
+
+  if (selection.systemPeer >= 0)
+    ntpLeapIndicator(peers[selection.systemPeer].leap, lastUpdate);
+}
+
+bool ntpUpstream(SntpUpstream &result)
+{
+  result = upstream;
+  return upstream.stratum != 0;
+}
+
+static void handleNtpGet()
+{
+  DynamicJsonDocument json(2048);
+  String body;
+  const uint64_t now = micros64();
+
+  json["synced"] = synced;
+  json["lastUpdate"] = (uint32_t)lastUpdate;
+  json["offsetUs"] = (int32_t)selection.offsetUs;
+  json["jitterUs"] = (int32_t)selection.jitterUs;
+  json["pollSeconds"] = 1U << discipline.pollExponent;
+  json["driftPpb"] = (int32_t)(discipline.frequencyPpm * 1000);
+  json["slewUs"] = discipline.slewing ? (int32_t)discipline.slewUs : 0;
+  json["systemPeer"] = selection.systemPeer >= 0 ? servers[selection.systemPeer].name : "";
+
+  JsonArray list = json.createNestedArray("servers");
+  for (uint8_t n = 0; n < serverCount; n++)
+  {
+    const Server &server = servers[n];
+    const NtpPeer &peer = peers[n];
+    JsonObject entry = list.createNestedObject();
+
+    entry["name"] = server.name;
+    entry["port"] = server.port;
+    entry["address"] = server.resolved ? server.address.toString() : String();
+    entry["reach"] = server.reach;
+    entry["sent"] = server.sent;
+    entry["received"] = server.received;
+    entry["rejected"] = server.rejected;
+    entry["survivor"] = selection.survivors[n];
+    if (!peer.valid)
+      continue;
+    entry["stratum"] = peer.stratum;
+    entry["offsetUs"] = (int32_t)peer.offsetUs;
+    entry["delayUs"] = (int32_t)peer.delayUs;
+    entry["dispersionUs"] = (int32_t)peer.dispersionUs;
+    entry["jitterUs"] = (int32_t)peer.jitterUs;
+    entry["distanceUs"] = (int32_t)ntpRootDistance(peer, now);
+  }
+
+  serializeJson(json, body);
+  webServer.send(200, "application/json", body);
+}
+
+void setupNtpClient()
+{
+  clearNtpDiscipline(discipline);
+  loadNtpServers();
+  webServer.on("/ntp", HTTP_GET, handleNtpGet);
+}
+
+void requestNtpPoll()
+{
+  pollRequested = true;
+}
+
+void setNtpSyncCallback(NtpSyncCallback callback)
+{
+  syncCallback = callback;
+}
+
+bool takeNtpSlewStep()
+{
+  const bool step = slewStepPending;
+
+  slewStepPending = false;
+  return step;
+}
+
+void serviceNtpClient()
+{
+  if ((Variant::Fleet && fleetRole == FleetFollower) || !serverCount)
+    return;
+
+  // Also while the WiFi is off
+  slewClock();
+
+  HeapScope heapScope(HeapNtp);
+
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    listening = false;
+    polling = false;
+    return;
+  }
+
+  if (!listening)
+  {
+    listening = ntpUdp.begin(NtpLocalPort);
+    if (!listening)
+      return;
+  }
+
+  if (polling)
+  {
+    receiveAnswers();
+    if (!answersPending() || millis() - pollStart > NtpResponseTimeoutMs)
+      updateClock();
+    return;
+  }
+
+  const unsigned long interval = burstLeft ? NtpBurstIntervalMs : (1000UL << discipline.pollExponent);
+  if (pollRequested || millis() - lastPoll >= interval)
+  {
+    pollRequested = false;
+    lastPoll = millis();
+    if (burstLeft)
+      burstLeft--;
+    sendPolls();
+  }
+}
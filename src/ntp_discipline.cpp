@@ -0,0 +1,88 @@
+#include "ntp_discipline.h"
+
+#include <string.h>
+
+/**
+ * Clock discipline of the NTP client
+ *
+ * There is no slewing adjtime() on the ESP8266, a slew is a series of settimeofday() steps of at most
+ * NtpSlewStepUs, paced at NtpSlewRatePpm. Only the first update and offsets beyond NtpStepOffsetUs step the clock
+ * at once. The poll interval follows the drift of the local clock and the jitter of the servers.
+ */
+
+void clearNtpDiscipline(NtpDiscipline &discipline)
+{
+  memset(&discipline, 0, sizeof(discipline));
+  discipline.pollExponent = NtpMinPollExponent;
+}
+
+static void setPollExponent(NtpDiscipline &discipline, uint8_t exponent)
+{
+  discipline.jiggle = 0;
+  discipline.pollExponent = exponent;
+}
+
+NtpCorrection updateNtpDiscipline(NtpDiscipline &discipline, int64_t offsetUs, int64_t jitterUs, uint64_t nowUs)
+{
+  const int64_t magnitude = offsetUs < 0 ? -offsetUs : offsetUs;
+
+  if (!discipline.synced || magnitude > NtpStepOffsetUs)
+  {
+    // Polling starts over, the drift is measured anew from here
+    clearNtpDiscipline(discipline);
+    discipline.synced = true;
+    discipline.lastUpdateUs = nowUs;
+    return NtpStep;
+  }
+
+  // The clock was right at the last update but for what was left of that offset, the rest is what it drifted
+  // since (the burst polls are too close together to tell drift from jitter)
+  const float elapsed = (nowUs - discipline.lastUpdateUs) / 1e6f;
+  if (elapsed >= (1 << NtpMinPollExponent))
+  {
+    float sample = (offsetUs - discipline.slewUs) / elapsed;
+    if (sample > NtpMaxFrequencyPpm)
+      sample = NtpMaxFrequencyPpm;
+    else if (sample < -NtpMaxFrequencyPpm)
+      sample = -NtpMaxFrequencyPpm;
+    discipline.frequencyPpm += (sample - discipline.frequencyPpm) / NtpFrequencyAverage;
+  }
+  discipline.lastUpdateUs = nowUs;
+
+  const float nextInterval = 1UL << (discipline.pollExponent + 1);
+  const float drift = discipline.frequencyPpm < 0 ? -discipline.frequencyPpm : discipline.frequencyPpm;
+  if (magnitude > NtpErrorBudgetUs)
+    setPollExponent(discipline, discipline.pollExponent > NtpMinPollExponent ? discipline.pollExponent - 1
+                                                                             : discipline.pollExponent);
+  else if (drift * nextInterval + jitterUs < NtpErrorBudgetUs / 2)
+  {
+    if (++discipline.jiggle >= NtpPollHysteresis && discipline.pollExponent < NtpMaxPollExponent)
+      setPollExponent(discipline, discipline.pollExponent + 1);
+  }
+  else
+    discipline.jiggle = 0;
+
+  discipline.slewUs = offsetUs;
+  discipline.slewing = magnitude > jitterUs || magnitude > NtpMaxIgnoredOffsetUs;
+
+  return discipline.slewing ? NtpSlew : NtpIgnore;
+}
+
+int64_t nextNtpSlewStep(NtpDiscipline &discipline, uint64_t elapsedUs)
+{
+  if (!discipline.slewing)
+    return 0;
+
+  const int64_t rest = discipline.slewUs < 0 ? -discipline.slewUs : discipline.slewUs;
+  const int64_t allowed = (int64_t)(elapsedUs * NtpSlewRatePpm / 1000000);
+  const int64_t due = rest < NtpSlewStepUs ? rest : NtpSlewStepUs;
+
+  if (allowed < due)
+    return 0;
+
+  const int64_t stepUs = discipline.slewUs < 0 ? -due : due;
+  discipline.slewUs -= stepUs;
+  discipline.slewing = discipline.slewUs != 0;
+
+  return stepUs;
+}
@@ -0,0 +1,91 @@
+#include "ntp_packet.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * NTP client packets (RFC 5905)
+ *
+ * The request only carries the transmit timestamp, the answer is taken if it comes from a synchronized server and
+ * echoes it. T1 (request sent) and T4 (answer received) are local clock, T2 (request received) and T3 (answer
+ * sent) server clock.
+ */
+
+#define ModeClient 3
+#define ModeServer 4
+#define LeapUnsynchronized 3
+#define MaxStratum 15
+
+static void putTimestamp(uint8_t *out, int64_t epochUs)
+{
+  const uint32_t seconds = (uint32_t)(epochUs / 1000000) + NtpUnixOffset;
+  const uint32_t fraction = (uint32_t)(((uint64_t)(epochUs % 1000000) << 32) / 1000000);
+
+  for (uint8_t n = 0; n < 4; n++)
+  {
+    out[n] = seconds >> (24 - 8 * n);
+    out[4 + n] = fraction >> (24 - 8 * n);
+  }
+}
+
+static uint32_t getUint32(const uint8_t *in)
+{
+  return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+static int64_t getTimestamp(const uint8_t *in)
+{
+  // Era 1 starts in 2036, timestamps below 2^31 seconds are taken from there
+  uint64_t seconds = getUint32(in);
+  if (seconds < 0x80000000UL)
+    seconds += 0x100000000ULL;
+
+  return ((int64_t)seconds - NtpUnixOffset) * 1000000LL + (int64_t)(((uint64_t)getUint32(in + 4) * 1000000) >> 32);
+}
+
+// NTP short format, 16.16 seconds
+static int64_t getShortUs(const uint8_t *in)
+{
+  return (int64_t)(((uint64_t)getUint32(in) * 1000000) >> 16);
+}
+
+void buildNtpRequest(uint8_t *packet, int64_t sentUs, NtpRequest &request)
+{
+  memset(packet, 0, NtpPacketBytes);
+  packet[0] = 4 << 3 | ModeClient;
+  putTimestamp(packet + 40, sentUs);
+
+  memcpy(request.cookie, packet + 40, sizeof(request.cookie));
+  request.sentUs = sentUs;
+}
+
+bool parseNtpAnswer(const uint8_t *packet, size_t length, const NtpRequest &request, int64_t receivedUs,
+                    uint64_t nowUs, NtpAnswer &answer)
+{
+  // A server answer, synchronized, echoing our request
+  if (length < NtpPacketBytes || (packet[0] & 7) != ModeServer || packet[0] >> 6 == LeapUnsynchronized ||
+      packet[1] == 0 || packet[1] > MaxStratum || memcmp(packet + 24, request.cookie, 8) != 0 ||
+      getUint32(packet + 40) == 0)
+    return false;
+
+  const int64_t t1 = request.sentUs;
+  const int64_t t2 = getTimestamp(packet + 32);
+  const int64_t t3 = getTimestamp(packet + 40);
+  const int64_t t4 = receivedUs;
+  const int64_t delay = (t4 - t1) - (t3 - t2);
+
+  NtpSample &sample = answer.sample;
+  sample.offsetUs = ((t2 - t1) + (t3 - t4)) / 2;
+  sample.delayUs = delay > 0 ? delay : 0;
+  // Precision of the server and ours (1 usec) plus the frequency tolerance over the round trip
+  sample.dispersionUs = (int64_t)ldexp(1000000.0, (int8_t)packet[3]) + 1 + (t4 - t1) * NtpPhiPpm / 1000000;
+  sample.timeUs = nowUs;
+  sample.valid = true;
+
+  answer.stratum = packet[1];
+  answer.leap = packet[0] >> 6;
+  answer.rootDelayUs = getShortUs(packet + 4);
+  answer.rootDispersionUs = getShortUs(packet + 8);
+
+  return true;
+}
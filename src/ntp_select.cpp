@@ -0,0 +1,260 @@
+#include "ntp_select.h"
+
+#include <math.h>
+#include <string.h>
+
+/**
+ * Clock filter, intersection, cluster and combine algorithms of RFC 5905 (sections 10 and 11.2), in integer
+ * microseconds where it matters and double for the RMS sums. See the pseudo code in appendix A.5 of the RFC.
+ */
+
+#define MaxSelectPeers 16
+
+static int64_t agedDispersion(const NtpSample &sample, uint64_t nowUs)
+{
+  return sample.dispersionUs + (int64_t)((nowUs - sample.timeUs) * NtpPhiPpm / 1000000);
+}
+
+void clearNtpPeer(NtpPeer &peer)
+{
+  memset(&peer, 0, sizeof(peer));
+}
+
+void addNtpSample(NtpPeer &peer, const NtpSample &sample, uint64_t nowUs)
+{
+  memmove(&peer.samples[1], &peer.samples[0], sizeof(NtpSample) * (NtpFilterStages - 1));
+  peer.samples[0] = sample;
+
+  // Samples in the order of their delay, the ones which aged beyond MAXDISP are left out
+  uint8_t order[NtpFilterStages];
+  int64_t dispersion[NtpFilterStages];
+  uint8_t count = 0;
+
+  for (uint8_t n = 0; n < NtpFilterStages; n++)
+  {
+    if (!peer.samples[n].valid)
+      continue;
+
+    const int64_t aged = agedDispersion(peer.samples[n], nowUs);
+    if (aged >= NtpMaxDispersionUs)
+      continue;
+
+    uint8_t position = count++;
+    for (; position > 0 && peer.samples[order[position - 1]].delayUs > peer.samples[n].delayUs; position--)
+    {
+      order[position] = order[position - 1];
+      dispersion[position] = dispersion[position - 1];
+    }
+    order[position] = n;
+    dispersion[position] = aged;
+  }
+
+  if (!count)
+  {
+    peer.valid = false;
+    return;
+  }
+
+  const NtpSample &best = peer.samples[order[0]];
+  peer.offsetUs = best.offsetUs;
+  peer.delayUs = best.delayUs;
+  peer.updateUs = best.timeUs;
+
+  // Dispersion: weighted sum over all stages, the empty ones count as MAXDISP
+  double weightedDispersion = 0;
+  double jitter = 0;
+  for (uint8_t n = 0; n < NtpFilterStages; n++)
+  {
+    weightedDispersion += (double)(n < count ? dispersion[n] : NtpMaxDispersionUs) / (2 << n);
+    if (n > 0 && n < count)
+    {
+      const double difference = (double)(peer.samples[order[n]].offsetUs - best.offsetUs);
+      jitter += difference * difference;
+    }
+  }
+
+  peer.dispersionUs = (int64_t)weightedDispersion;
+  peer.jitterUs = count > 1 ? (int64_t)sqrt(jitter / (count - 1)) : 0;
+  if (peer.jitterUs < 1)
+    peer.jitterUs = 1;
+  peer.valid = true;
+}
+
+void shiftNtpPeer(NtpPeer &peer, int64_t stepUs)
+{
+  for (uint8_t n = 0; n < NtpFilterStages; n++)
+    peer.samples[n].offsetUs -= stepUs;
+  peer.offsetUs -= stepUs;
+}
+
+int64_t ntpRootDistance(const NtpPeer &peer, uint64_t nowUs)
+{
+  const int64_t delay = peer.rootDelayUs + peer.delayUs;
+
+  return (delay > NtpMinDispersionUs ? delay : NtpMinDispersionUs) / 2 + peer.rootDispersionUs + peer.dispersionUs +
+         (int64_t)((nowUs - peer.updateUs) * NtpPhiPpm / 1000000) + peer.jitterUs;
+}
+
+struct Edge
+{
+  int64_t value;
+  int8_t type; // -1 low end, 0 offset, +1 high end of a correctness interval
+};
+
+bool selectNtpPeers(const NtpPeer *peers, uint8_t count, uint64_t nowUs, NtpSelection *selection)
+{
+  Edge edges[3 * MaxSelectPeers];
+  int64_t distance[MaxSelectPeers];
+  uint8_t edgeCount = 0;
+  uint8_t candidates = 0;
+
+  memset(selection, 0, sizeof(*selection));
+  selection->systemPeer = -1;
+  if (count > MaxSelectPeers)
+    count = MaxSelectPeers;
+
+  for (uint8_t n = 0; n < count; n++)
+  {
+    distance[n] = ntpRootDistance(peers[n], nowUs);
+    if (!peers[n].valid || distance[n] >= NtpMaxDistanceUs)
+      continue;
+
+    const Edge peerEdges[3] = {{peers[n].offsetUs - distance[n], -1}, {peers[n].offsetUs, 0},
+                               {peers[n].offsetUs + distance[n], +1}};
+    for (const Edge &edge : peerEdges)
+    {
+      uint8_t position = edgeCount++;
+      for (; position > 0 && edges[position - 1].value > edge.value; position--)
+        edges[position] = edges[position - 1];
+      edges[position] = edge;
+    }
+    candidates++;
+  }
+
+  // Intersection: the smallest interval containing points of at least candidates - allow intervals, with at most
+  // allow offsets outside of it
+  int64_t low = 0;
+  int64_t high = 0;
+  uint8_t allow = 0;
+  for (; 2 * allow < candidates; allow++)
+  {
+    int found = 0;
+    int chime = 0;
+
+    for (int n = 0; n < edgeCount; n++)
+    {
+      chime -= edges[n].type;
+      if (chime >= candidates - allow)
+      {
+        low = edges[n].value;
+        break;
+      }
+      if (edges[n].type == 0)
+        found++;
+    }
+
+    chime = 0;
+    for (int n = edgeCount - 1; n >= 0; n--)
+    {
+      chime += edges[n].type;
+      if (chime >= candidates - allow)
+      {
+        high = edges[n].value;
+        break;
+      }
+      if (edges[n].type == 0)
+        found++;
+    }
+
+    if (found <= allow && high > low)
+      break;
+  }
+
+  if (2 * allow >= candidates)
+    return false;
+
+  for (uint8_t n = 0; n < count; n++)
+  {
+    if (peers[n].valid && distance[n] < NtpMaxDistanceUs && peers[n].offsetUs >= low && peers[n].offsetUs <= high)
+    {
+      selection->survivors[n] = true;
+      selection->survivorCount++;
+    }
+  }
+
+  if (!selection->survivorCount)
+    return false;
+
+  // Cluster: drop the survivor farthest from the others while that spread is above the jitter of the peers
+  while (selection->survivorCount > NtpMinClusterSurvivors)
+  {
+    double maxJitter = -1;
+    int64_t minPeerJitter = INT64_MAX;
+    uint8_t outlier = 0;
+
+    for (uint8_t i = 0; i < count; i++)
+    {
+      if (!selection->survivors[i])
+        continue;
+
+      double sum = 0;
+      for (uint8_t j = 0; j < count; j++)
+      {
+        if (!selection->survivors[j])
+          continue;
+        const double difference = (double)(peers[i].offsetUs - peers[j].offsetUs);
+        sum += difference * difference;
+      }
+
+      const double jitter = sqrt(sum / (selection->survivorCount - 1));
+      if (jitter > maxJitter)
+      {
+        maxJitter = jitter;
+        outlier = i;
+      }
+      if (peers[i].jitterUs < minPeerJitter)
+        minPeerJitter = peers[i].jitterUs;
+    }
+
+    if (maxJitter <= minPeerJitter)
+      break;
+
+    selection->survivors[outlier] = false;
+    selection->survivorCount--;
+  }
+
+  // Combine: offsets weighted by the inverse root distance, the system peer has the least stratum and distance
+  double weights = 0;
+  double offset = 0;
+  int64_t bestMerit = INT64_MAX;
+
+  for (uint8_t n = 0; n < count; n++)
+  {
+    if (!selection->survivors[n])
+      continue;
+
+    weights += 1.0 / distance[n];
+    offset += peers[n].offsetUs / (double)distance[n];
+
+    const int64_t merit = peers[n].stratum * (int64_t)NtpMaxDistanceUs + distance[n];
+    if (merit < bestMerit)
+    {
+      bestMerit = merit;
+      selection->systemPeer = n;
+    }
+  }
+
+  selection->offsetUs = (int64_t)(offset / weights);
+
+  double jitter = 0;
+  for (uint8_t n = 0; n < count; n++)
+  {
+    if (!selection->survivors[n])
+      continue;
+    const double difference = (double)(peers[n].offsetUs - peers[selection->systemPeer].offsetUs);
+    jitter += difference * difference / distance[n];
+  }
+  selection->jitterUs = (int64_t)sqrt(jitter / weights);
+
+  return true;
+}
@@ -0,0 +1,192 @@
+#include "phase_carrier.h"
+#include "i2s_dma.h"
+#include "scheduler.h"
+
+extern "C"
+{
+#include "ets_sys.h"
+}
+
+/**
+ * Phase modulated carrier (DCF77 PRN time code)
+ *
+ * Besides the amplitude pulses DCF77 keys its carrier in phase: from 200 msec into every second 512 chips of a
+ * pseudo random sequence shift the phase by +/- 15.6 degrees, the sequence is inverted for a 1 data bit (the same
+ * bit the amplitude pulse of the second carries, the minute marker sends a 0). Receivers correlate the sequence,
+ * which gives a much more precise second mark than the slow pulse edges.
+ *
+ * The 5 MHz stream is rendered word by word from the carrier patterns of carrier.cpp: word n of a pattern starts
+ * at carrier phase n * 62 / 125 cycle, so another word of the same pattern is the carrier shifted in phase by a
+ * multiple of 1/125 cycle. Generating a chip is a pure table walk: look up the chip, add its fixed word offset to
+ * the position in the pattern and copy the word. Pulse edges, chip and second boundaries take effect at the next
+ * word (6.4 usec).
+ */
+
+// 9 stage LFSR x^9 + x^5 + 1 started with all ones (511 chips, MSB first) followed by a single 0 chip
+static const uint8_t prnChipsFlash[PrnChips / 8] PROGMEM = {
+    0xFF, 0x83, 0xDF, 0x17, 0x32, 0x09, 0x4E, 0xD1, 0xE7, 0xCD, 0x8A, 0x91, 0xC6, 0xD5, 0xC4, 0xC4,
+    0x40, 0x21, 0x18, 0x4E, 0x55, 0x86, 0xF4, 0xDC, 0x8A, 0x15, 0xA7, 0xEC, 0x92, 0xDF, 0x93, 0x53,
+    0x30, 0x18, 0xCA, 0x34, 0xBF, 0xA2, 0xC7, 0x59, 0x67, 0x8F, 0xBA, 0x0D, 0x6D, 0xD8, 0x2D, 0x7D,
+    0x54, 0x0A, 0x57, 0x97, 0x70, 0x39, 0xD2, 0x7A, 0xEA, 0x24, 0x33, 0x85, 0xED, 0x9A, 0x1D, 0xE0,
+};
+
+#define PrnStartBits ((uint32_t)PrnStartMs * (PhaseCarrierBitsPerSecond / 1000))
+#define PhaseCarrierBitsPerUs (PhaseCarrierBitsPerSecond / 1000000)
+
+// RAM copy of the chips, the interrupt must not read flash (the cache is off while the flash is written)
+static uint8_t prnChips[PrnChips / 8];
+
+static uint32_t buffers[PhaseCarrierBuffers][PhaseCarrierBufferWords];
+static I2sDmaDescriptor ring[PhaseCarrierBuffers];
+
+static const DcfChannel *phaseChannel = nullptr;
+static EdgeState state = {nullptr, 0, 0, 0, 0, 0, false, true};
+
+// micros64() time of the first bit of the stream
+static uint64_t streamStart = 0;
+// First bit of the next buffer to render, the pattern word it starts with and the bit of the next pulse edge
+static uint64_t bufferStartBit = 0;
+static uint8_t carrierWord = 0;
+static uint64_t nextEdgeBit = 0;
+
+// Pattern word offset which shifts the phase of a 0 chip (advanced) and a 1 chip (retarded)
+static uint8_t chipShiftWords[2];
+
+// Second of the pulses being keyed (-1: none), its data bit, position in it and the chip being sent
+static int keyedSecond = -1;
+static uint8_t dataBit = 0;
+static int32_t bitInSecond = 0;
+static uint16_t chip = 0;
+static uint32_t chipEnd = 0;
+
+static inline uint64_t IRAM_ATTR edgeBit(uint64_t edgeMicros)
+{
+  return (edgeMicros - streamStart) * PhaseCarrierBitsPerUs;
+}
+
+static inline uint8_t IRAM_ATTR symbolDataBit(int second)
+{
+  // DCF77 symbol 2 (200 msec pulse) is a 1, the minute marker and bit 0 send the plain sequence
+  return state.pulses[second] == 2 ? 1 : 0;
+}
+
+static void IRAM_ATTR startSecond()
+{
+  chip = 0;
+  chipEnd = PrnStartBits + PhaseCarrierChipBits(1);
+  dataBit = symbolDataBit(keyedSecond);
+}
+
+/**
+ * Pattern word offset of the chip at the current position, 0 outside of the chip sequence.
+ */
+static inline uint8_t IRAM_ATTR chipShift()
+{
+  if (bitInSecond >= (int32_t)PhaseCarrierBitsPerSecond)
+  {
+    bitInSecond -= PhaseCarrierBitsPerSecond;
+    if (++keyedSecond >= state.pulseCount)
+    {
+      keyedSecond = -1;
+      return 0;
+    }
+    startSecond();
+  }
+
+  if (bitInSecond < (int32_t)PrnStartBits || chip >= PrnChips)
+    return 0;
+
+  if ((uint32_t)bitInSecond >= chipEnd)
+  {
+    chip++;
+    chipEnd = PrnStartBits + PhaseCarrierChipBits(chip + 1);
+    if (chip >= PrnChips)
+      return 0;
+  }
+
+  const uint8_t value = (prnChips[chip / 8] >> (7 - chip % 8)) & 1;
+
+  return chipShiftWords[value ^ dataBit];
+}
+
+static void IRAM_ATTR renderBuffer(uint32_t *buffer)
+{
+  const uint32_t *full = carrierPattern(false);
+  const uint32_t *reduced = carrierPattern(true);
+  uint64_t bit = bufferStartBit;
+
+  for (uint32_t word = 0; word < PhaseCarrierBufferWords; word++, bit += 32)
+  {
+    while (!state.done && nextEdgeBit <= bit)
+    {
+      advanceEdgeState(state, *phaseChannel);
+      nextEdgeBit = edgeBit(state.nextEdge);
+    }
+
+    uint32_t index = carrierWord;
+    if (keyedSecond >= 0)
+    {
+      index += chipShift();
+      if (index >= CarrierBufferWords)
+        index -= CarrierBufferWords;
+      bitInSecond += 32;
+    }
+
+    buffer[word] = (state.inPulse ? reduced : full)[index];
+
+    if (++carrierWord == CarrierBufferWords)
+      carrierWord = 0;
+  }
+
+  bufferStartBit = bit;
+}
+
+static void IRAM_ATTR onBufferDone(I2sDmaDescriptor *descriptor)
+{
+  // The buffer just sent is queued again behind the other one, fill it with the words following that one
+  renderBuffer(descriptor->buf_ptr);
+}
+
+void setupPhaseCarrier(const DcfChannel &channel)
+{
+  phaseChannel = &channel;
+  state.done = true;
+  state.inPulse = false;
+  keyedSecond = -1;
+
+  memcpy_P(prnChips, prnChipsFlash, sizeof(prnChips));
+
+  // Word n of a pattern starts at phase n * CarrierBufferCycles (in 1/CarrierBufferWords cycles), so a shift of
+  // one phase step is the inverse of CarrierBufferCycles modulo CarrierBufferWords
+  uint32_t inverse = 1;
+  while ((inverse * CarrierBufferCycles) % CarrierBufferWords != 1)
+    inverse++;
+  chipShiftWords[0] = (PrnPhaseSteps * inverse) % CarrierBufferWords;
+  chipShiftWords[1] = CarrierBufferWords - chipShiftWords[0];
+
+  renderCarrierPatterns();
+  i2sDmaInitRing(ring, PhaseCarrierBuffers, buffers[0], PhaseCarrierBufferWords, true);
+
+  bufferStartBit = 0;
+  carrierWord = 0;
+  for (uint8_t n = 0; n < PhaseCarrierBuffers; n++)
+    renderBuffer(buffers[n]);
+
+  streamStart = micros64();
+  i2sDmaBegin(ring, CarrierClockDiv, CarrierBitClockDiv, onBufferDone);
+}
+
+void IRAM_ATTR phaseCarrierStart(const Transmission &transmission, uint8_t index)
+{
+  if (!phaseChannel)
+    return;
+
+  ETS_SLC_INTR_DISABLE();
+  resetEdgeState(state, *phaseChannel, transmission, index);
+  nextEdgeBit = edgeBit(state.nextEdge);
+
+  keyedSecond = 0;
+  bitInSecond = (int32_t)(bufferStartBit - edgeBit(state.start));
+  startSecond();
+  ETS_SLC_INTR_ENABLE();
+}
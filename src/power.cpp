@@ -0,0 +1,200 @@
+#include "power.h"
+#include "config.h"
+#include "log.h"
+#include "ntp_client.h"
+#include "channels.h"
+#include "scheduler.h"
+#include "web.h"
+#include "wifi_portal.h"
+
+#include <ESP8266WiFi.h>
+#include <ArduinoJson.h>
+
+/**
+ * Power save mode
+ *
+ * The radio is by far the largest consumer, so in power save mode it is switched off completely and only woken
+ * for a batched NTP sync once an hour (and for the config portal). While it is on, modem sleep keeps it off
+ * between the beacons. The edges themselves are not touched: light sleep would stop the CPU clock timer1 and
+ * micros64() run from, so the CPU keeps running and loop() idles in delay() instead of spinning. The edge scheduler
+ * decides how long: loop() sleeps through the next edge and resumes right behind it, so its work always falls into
+ * the gap between two edges.
+ * The current cannot be measured on the module itself, the energy is estimated from the time spent in every radio
+ * state and the nominal currents of the ESP8266.
+ */
+
+bool powerSave = false;
+
+enum PowerLevel : uint8_t
+{
+  LevelRadioOn,
+  LevelModemSleep,
+  LevelRadioOff,
+  PowerLevels,
+};
+
+static const uint16_t levelCurrentMa[PowerLevels] = {RadioOnCurrentMa, ModemSleepCurrentMa, RadioOffCurrentMa};
+static const char *const levelNames[PowerLevels] = {"radioOnMs", "modemSleepMs", "radioOffMs"};
+
+static bool radioOn = true;
+static unsigned long radioOnSince = 0;
+static unsigned long nextSync = 0;
+// An NTP sync was asked for / received since the radio was switched on
+static bool syncRequested = true; // by setup()
+static bool synced = false;
+
+// Time spent in every level during the running hour and the last complete one
+static uint32_t levelMs[PowerLevels];
+static uint32_t lastHourLevelMs[PowerLevels];
+static unsigned long hourStart = 0;
+static unsigned long lastAccount = 0;
+
+static PowerLevel currentLevel()
+{
+  if (!radioOn)
+    return LevelRadioOff;
+
+  return WiFi.getSleepMode() == WIFI_NONE_SLEEP ? LevelRadioOn : LevelModemSleep;
+}
+
+static uint32_t estimatedMicroAh(const uint32_t *ms)
+{
+  uint64_t milliAmpMs = 0;
+
+  for (uint8_t n = 0; n < PowerLevels; n++)
+    milliAmpMs += (uint64_t)ms[n] * levelCurrentMa[n];
+
+  return milliAmpMs / 3600;
+}
+
+static void accountEnergy()
+{
+  const unsigned long now = millis();
+
+  levelMs[currentLevel()] += now - lastAccount;
+  lastAccount = now;
+
+  if (now - hourStart < 3600000UL)
+    return;
+
+  memcpy(lastHourLevelMs, levelMs, sizeof(levelMs));
+  memset(levelMs, 0, sizeof(levelMs));
+  hourStart += 3600000UL;
+
+  logInfo("energy of the last hour: %u uAh (radio on %u s, modem sleep %u s, off %u s)",
+          estimatedMicroAh(lastHourLevelMs), lastHourLevelMs[LevelRadioOn] / 1000,
+          lastHourLevelMs[LevelModemSleep] / 1000, lastHourLevelMs[LevelRadioOff] / 1000);
+}
+
+static void addHour(JsonObject json, const uint32_t *ms)
+{
+  for (uint8_t n = 0; n < PowerLevels; n++)
+    json[levelNames[n]] = ms[n];
+  json["estimatedMicroAh"] = estimatedMicroAh(ms);
+}
+
+static void handlePowerGet()
+{
+  DynamicJsonDocument json(512);
+  String body;
+
+  accountEnergy();
+
+  json["powerSave"] = powerSave;
+  json["radio"] = radioOn ? "on" : "off";
+  addHour(json.createNestedObject("lastHour"), lastHourLevelMs);
+  addHour(json.createNestedObject("currentHour"), levelMs);
+
+  serializeJson(json, body);
+  webServer.send(200, "application/json", body);
+}
+
+bool radioEnabled()
+{
+  return radioOn;
+}
+
+void wakeRadio()
+{
+  if (radioOn)
+    return;
+
+  accountEnergy();
+  WiFi.forceSleepWake();
+
+  radioOn = true;
+  radioOnSince = millis();
+  syncRequested = false;
+  synced = false;
+
+  logDebug("radio on");
+}
+
+void powerTimeSynced()
+{
+  synced = true;
+}
+
+/**
+ * Idle until PowerEdgeGuardUs after the next edge timer interrupt, at most maxIdleUs (or a little longer, rather
+ * than waking up just before an edge).
+ */
+static void idleUntilEdge(uint32_t maxIdleUs)
+{
+  const uint64_t now = micros64();
+  const uint64_t edge = nextEdgeMicros();
+  uint64_t wake = now + maxIdleUs;
+
+  if (edge && edge < wake + PowerEdgeGuardUs)
+    wake = edge + PowerEdgeGuardUs;
+  if (wake <= now)
+    return;
+
+  delay((wake - now + 999) / 1000);
+}
+
+void servicePower()
+{
+  accountEnergy();
+
+  if (!powerSave)
+    return;
+
+  const unsigned long now = millis();
+
+  if (radioOn)
+  {
+    // Ask for the time right away instead of waiting for the next SNTP poll
+    if (!syncRequested && WiFi.status() == WL_CONNECTED)
+    {
+      requestNtpPoll();
+      syncRequested = true;
+    }
+
+    // Not while someone is using the config portal
+    if ((synced || now - radioOnSince > PowerSyncTimeoutMs) && !configPortalActive())
+    {
+      nextSync = now + (synced ? PowerSyncIntervalMs : PowerSyncRetryMs);
+
+      WiFi.forceSleepBegin();
+      radioOn = false;
+
+      logDebug("%s, radio off", synced ? "time synced" : "no time sync");
+    }
+  }
+  else if ((long)(now - nextSync) >= 0)
+    wakeRadio();
+
+  // The NTP answers are timestamped when loop() sees them, while the radio is on only the edges are slept through
+  idleUntilEdge(radioOn ? 0 : PowerMaxIdleMs * 1000UL);
+}
+
+void setupPower()
+{
+  hourStart = lastAccount = radioOnSince = millis();
+
+  if (powerSave)
+    WiFi.setSleepMode(WIFI_MODEM_SLEEP);
+
+  webServer.on("/power", HTTP_GET, handlePowerGet);
+}
@@ -0,0 +1,285 @@
+#include "protocol.h"
+
+/**
+ * Write value as BCD, MSB first, into bits [first, first + count) using the given digit weights
+ * (0 marks an unused bit which stays 0), e.g. {40, 20, 10, 0, 8, 4, 2, 1}.
+ */
+static void setWeightedBits(uint8_t *bits, int first, int value, const uint8_t *weights, int count)
+{
+  for (int n = 0; n < count; n++)
+  {
+    const uint8_t weight = weights[n];
+
+    bits[first + n] = 0;
+    if (weight && value >= weight)
+    {
+      bits[first + n] = 1;
+      value -= weight;
+    }
+  }
+}
+
+static int bin2Bcd(int dato)
+{
+  return ((dato / 10) << 4) + dato % 10;
+}
+
+/**
+ * Write value as BCD, LSB first, into the DCF77 symbols [first, first + count) (1 = bit 0, 2 = bit 1),
+ * returns the number of 1 bits.
+ */
+static int setDcfBcd(uint8_t *symbols, int first, int value, int count)
+{
+  int ParityCount = 0;
+  int TmpIn = bin2Bcd(value);
+
+  for (int n = first; n < first + count; n++)
+  {
+    symbols[n] = (TmpIn & 1) + 1;
+    ParityCount += TmpIn & 1;
+    TmpIn >>= 1;
+  }
+
+  return ParityCount;
+}
+
+static int countBits(const uint8_t *bits, int first, int last)
+{
+  int count = 0;
+
+  for (int n = first; n <= last; n++)
+    count += bits[n];
+
+  return count;
+}
+
+/*** DCF77 ***/
+
+const SymbolWaveform Dcf77::Waveforms[3] = {
+    {0, {}},
+    {2, {0, 100}},
+    {2, {0, 200}},
+};
+
+static void encodeDcfFields(uint8_t *symbols, const FrameTime &time, uint8_t fields)
+{
+  const tm &timeinfo = time.announced;
+  int ParityCount;
+
+  //DayLightSaving announcement and bits, leap second announcement
+  if (fields & Dcf77::FlagsField)
+  {
+    symbols[16] = time.dstChange + 1;
+    symbols[17] = (timeinfo.tm_isdst == 1) + 1;
+    symbols[18] = (timeinfo.tm_isdst != 1) + 1;
+    symbols[19] = time.leapAnnounced + 1;
+  }
+
+  //minutes bits with parity
+  if (fields & Dcf77::MinuteField)
+  {
+    ParityCount = setDcfBcd(symbols, 21, timeinfo.tm_min, 7);
+    symbols[28] = (ParityCount & 1) + 1;
+  }
+
+  //hour bits with parity
+  if (fields & Dcf77::HourField)
+  {
+    ParityCount = setDcfBcd(symbols, 29, timeinfo.tm_hour, 6);
+    symbols[35] = (ParityCount & 1) + 1;
+  }
+
+  //day, weekday (monday = 1 .. sunday = 7), month and year bits with one common parity
+  if (fields & Dcf77::DateField)
+  {
+    ParityCount = setDcfBcd(symbols, 36, timeinfo.tm_mday, 6);
+    ParityCount += setDcfBcd(symbols, 42, timeinfo.tm_wday == 0 ? 7 : timeinfo.tm_wday, 3);
+    ParityCount += setDcfBcd(symbols, 45, timeinfo.tm_mon + 1, 5);
+    ParityCount += setDcfBcd(symbols, 50, timeinfo.tm_year % 100, 8);
+    symbols[58] = (ParityCount & 1) + 1;
+  }
+}
+
+void Dcf77::encodeFrame(uint8_t *symbols, const FrameTime &time)
+{
+  //first 15 bits are logical 0s (weather and civil warning, call bit)
+  for (int n = 0; n < 59; n++)
+    symbols[n] = 1;
+
+  //bit 20 must be 1 to indicate time active
+  symbols[20] = 2;
+
+  //last missing pulse
+  symbols[59] = 0;
+
+  encodeDcfFields(symbols, time, AllFields);
+}
+
+void Dcf77::updateFrame(uint8_t *symbols, const FrameTime &previous, const FrameTime &time)
+{
+  const tm &was = previous.announced;
+  const tm &now = time.announced;
+  uint8_t fields = 0;
+
+  if (now.tm_min != was.tm_min)
+    fields |= MinuteField;
+  if (now.tm_hour != was.tm_hour)
+    fields |= HourField;
+  if (now.tm_mday != was.tm_mday || now.tm_wday != was.tm_wday || now.tm_mon != was.tm_mon || now.tm_year != was.tm_year)
+    fields |= DateField;
+  if (now.tm_isdst != was.tm_isdst || time.dstChange != previous.dstChange ||
+      time.leapAnnounced != previous.leapAnnounced)
+    fields |= FlagsField;
+
+  encodeDcfFields(symbols, time, fields);
+}
+
+/*** MSF ***/
+
+const SymbolWaveform Msf::Waveforms[5] = {
+    {2, {0, 100}},
+    {2, {0, 200}},
+    {4, {0, 100, 200, 300}},
+    {2, {0, 300}},
+    {2, {0, 500}},
+};
+
+void Msf::encodeFrame(uint8_t *symbols, const FrameTime &time)
+{
+  static const uint8_t yearWeights[] = {80, 40, 20, 10, 8, 4, 2, 1};
+  static const uint8_t monthWeights[] = {10, 8, 4, 2, 1};
+  static const uint8_t dayWeights[] = {20, 10, 8, 4, 2, 1};
+  static const uint8_t weekdayWeights[] = {4, 2, 1};
+  static const uint8_t minuteWeights[] = {40, 20, 10, 8, 4, 2, 1};
+
+  const tm &timeinfo = time.announced;
+  uint8_t a[60] = {};
+  uint8_t b[60] = {};
+
+  // 1..16 DUT1 stays 0
+  setWeightedBits(a, 17, timeinfo.tm_year % 100, yearWeights, 8);
+  setWeightedBits(a, 25, timeinfo.tm_mon + 1, monthWeights, 5);
+  setWeightedBits(a, 30, timeinfo.tm_mday, dayWeights, 6);
+  setWeightedBits(a, 36, timeinfo.tm_wday, weekdayWeights, 3);
+  setWeightedBits(a, 39, timeinfo.tm_hour, dayWeights, 6);
+  setWeightedBits(a, 45, timeinfo.tm_min, minuteWeights, 7);
+
+  // Fixed 01111110 identifies the end of the minute
+  for (int n = 53; n <= 58; n++)
+    a[n] = 1;
+
+  // Summer time warning, odd parities and summer time
+  b[53] = time.dstChange;
+  b[54] = !(countBits(a, 17, 24) & 1);
+  b[55] = !(countBits(a, 25, 35) & 1);
+  b[56] = !(countBits(a, 36, 38) & 1);
+  b[57] = !(countBits(a, 39, 51) & 1);
+  b[58] = timeinfo.tm_isdst == 1;
+
+  symbols[0] = 4;
+  for (int n = 1; n < 60; n++)
+    symbols[n] = a[n] + 2 * b[n];
+}
+
+/*** WWVB ***/
+
+const SymbolWaveform Wwvb::Waveforms[3] = {
+    {2, {0, 200}},
+    {2, {0, 500}},
+    {2, {0, 800}},
+};
+
+void Wwvb::encodeFrame(uint8_t *symbols, const FrameTime &time)
+{
+  static const uint8_t minuteWeights[] = {40, 20, 10, 0, 8, 4, 2, 1};
+  static const uint8_t hourWeights[] = {20, 10, 0, 8, 4, 2, 1};
+  static const uint8_t dayHundredsWeights[] = {200, 100, 0, 80, 40, 20, 10};
+  static const uint8_t dayUnitsWeights[] = {8, 4, 2, 1};
+  static const uint8_t yearTensWeights[] = {80, 40, 20, 10};
+
+  tm utc;
+  uint8_t bits[60] = {};
+
+  // WWVB sends UTC of the minute which begins with the frame
+  gmtime_r(&time.start, &utc);
+
+  const int year = utc.tm_year + 1900;
+  const int dayOfYear = utc.tm_yday + 1;
+
+  setWeightedBits(bits, 1, utc.tm_min, minuteWeights, 8);
+  setWeightedBits(bits, 12, utc.tm_hour, hourWeights, 7);
+  setWeightedBits(bits, 22, dayOfYear - dayOfYear % 10, dayHundredsWeights, 7);
+  setWeightedBits(bits, 30, dayOfYear % 10, dayUnitsWeights, 4);
+
+  // DUT1 sign positive (101), value 0
+  bits[36] = 1;
+  bits[38] = 1;
+
+  setWeightedBits(bits, 45, year % 100 - year % 10, yearTensWeights, 4);
+  setWeightedBits(bits, 50, year % 10, dayUnitsWeights, 4);
+
+  bits[55] = (year % 4 == 0 && year % 100 != 0) || year % 400 == 0;
+  bits[56] = time.leapMonth;
+  bits[57] = time.dstAtDayEnd;
+  bits[58] = time.dstAtDayStart;
+
+  for (int n = 0; n < 60; n++)
+    symbols[n] = bits[n];
+
+  // Position markers
+  symbols[0] = 2;
+  for (int n = 9; n < 60; n += 10)
+    symbols[n] = 2;
+}
+
+/*** JJY ***/
+
+template <uint32_t Frequency>
+const SymbolWaveform Jjy<Frequency>::Waveforms[3] = {
+    {2, {800, 1000}},
+    {2, {500, 1000}},
+    {2, {200, 1000}},
+};
+
+template <uint32_t Frequency>
+void Jjy<Frequency>::encodeFrame(uint8_t *symbols, const FrameTime &time)
+{
+  static const uint8_t minuteWeights[] = {40, 20, 10, 0, 8, 4, 2, 1};
+  static const uint8_t hourWeights[] = {20, 10, 0, 8, 4, 2, 1};
+  static const uint8_t dayHundredsWeights[] = {200, 100, 0, 80, 40, 20, 10};
+  static const uint8_t unitsWeights[] = {8, 4, 2, 1};
+  static const uint8_t yearWeights[] = {80, 40, 20, 10, 8, 4, 2, 1};
+  static const uint8_t weekdayWeights[] = {4, 2, 1};
+
+  // JJY sends the local time (JST) of the minute which begins with the frame
+  const tm &timeinfo = time.local;
+  const int dayOfYear = timeinfo.tm_yday + 1;
+  uint8_t bits[60] = {};
+
+  setWeightedBits(bits, 1, timeinfo.tm_min, minuteWeights, 8);
+  setWeightedBits(bits, 12, timeinfo.tm_hour, hourWeights, 7);
+  setWeightedBits(bits, 22, dayOfYear - dayOfYear % 10, dayHundredsWeights, 7);
+  setWeightedBits(bits, 30, dayOfYear % 10, unitsWeights, 4);
+
+  // Even parities of hour and minute
+  bits[36] = countBits(bits, 12, 18) & 1;
+  bits[37] = countBits(bits, 1, 8) & 1;
+
+  setWeightedBits(bits, 41, timeinfo.tm_year % 100, yearWeights, 8);
+  setWeightedBits(bits, 50, timeinfo.tm_wday, weekdayWeights, 3);
+
+  // Leap second at the end of this month (LS1), inserted (LS2)
+  bits[53] = time.leapMonth;
+  bits[54] = time.leapMonth;
+
+  for (int n = 0; n < 60; n++)
+    symbols[n] = bits[n];
+
+  // Position markers
+  symbols[0] = 2;
+  for (int n = 9; n < 60; n += 10)
+    symbols[n] = 2;
+}
+
+template struct Jjy<40000>;
+template struct Jjy<60000>;
@@ -0,0 +1,294 @@
+#include "schedule.h"
+#include "config.h"
+#include "channels.h"
+#include "scheduler.h"
+#include "log.h"
+#include "ntp_client.h"
+#include "leap.h"
+
+#include <ESP8266WiFi.h>
+#include <coredecls.h>
+#include <sys/time.h>
+
+/**
+ * Scheduled mode (deep sleep duty cycle)
+ *
+ * A clock which resyncs once a day only needs the signal for a few minutes, so in scheduled mode the ESP sends a
+ * single burst per wake up and deep sleeps until the next one (GPIO16 must be wired to RST). Before sleeping the
+ * wall clock, the config and the learned drift of the RTC clock go into the RTC user memory (behind the first 128
+ * bytes, which eboot uses), it survives the deep sleep. On wake up the config and an estimate of the time are
+ * restored from there, without mounting LittleFS or starting WiFiManager; a quick connection with the stored
+ * credentials then fetches the exact time by NTP, the difference to the estimate corrects the drift. Sleeps longer
+ * than ESP.deepSleepMax() (~3.5 h) are chained, the wake ups in between go back to sleep right away with the radio
+ * off.
+ */
+
+uint16_t scheduleMinutes = 0;
+
+#define RtcStateMagic 0x44434653UL
+// Bounds of the learned drift, the RTC clock of the ESP8266 is off by a few percent at most
+#define MaxDriftPpm 100000.0f
+// Shortest deep sleep, 0 would never wake up again
+#define MinDeepSleepUs 1000000ULL
+// The first 128 bytes of the RTC user memory belong to eboot (OTA update commands), the state goes behind them
+#define RtcStateBlock 32
+// ntpServer and ntpServers one after the other, each with its terminating zero
+#define RtcNtpNamesBytes 96
+
+struct RtcState
+{
+  uint32_t magic;
+  uint32_t crc;              // of everything behind it
+  int64_t sleepEpochUs;      // wall clock when the sleep began
+  uint64_t sleepUs;          // asked length of the sleep (RTC clock)
+  uint64_t sleptSinceSyncUs; // asked sleep since the last NTP sync
+  int64_t nextBurst;         // first frame of the next scheduled burst
+  int64_t nextLeapSecond;    // end of the next known leap second, 0 = none
+  float driftPpm;            // RTC clock too slow (positive) or too fast, learned from the NTP syncs
+  uint16_t scheduleMinutes;
+  uint8_t channelCount;
+  BurstConfig burst;
+  char ntpNames[RtcNtpNamesBytes]; // servers which do not fit any more are left out
+  DcfChannel channels[MaxChannels];
+};
+
+static_assert(RtcStateBlock * 4 + sizeof(RtcState) <= 512, "the RTC user memory has 512 bytes");
+static_assert(sizeof(RtcState) % 4 == 0, "the RTC user memory is written in words");
+
+static RtcState rtc;
+static bool resumed = false;
+
+// Time restored from the RTC state (wall clock and micros64()), compared to the next NTP sync
+static int64_t estimateEpochUs = 0;
+static uint64_t estimateMicros = 0;
+static bool estimatePending = false;
+
+// The burst of this wake up was queued
+static bool queued = false;
+static time_t queuedFirstFrame = 0;
+
+static int64_t wallClockUs()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static uint32_t stateCrc(const RtcState &state)
+{
+  const size_t start = offsetof(RtcState, sleepEpochUs);
+
+  return crc32((const uint8_t *)&state + start, sizeof(state) - start);
+}
+
+/**
+ * Pack ntpServer and the used ntpServers into rtc.ntpNames.
+ */
+static void storeNtpNames()
+{
+  size_t length = strlcpy(rtc.ntpNames, ntpServer, sizeof(rtc.ntpNames)) + 1;
+
+  for (uint8_t n = 0; n < NtpMaxServers - 1; n++)
+  {
+    const size_t size = strlen(ntpServers[n]) + 1;
+
+    if (size == 1)
+      continue;
+    if (length + size > sizeof(rtc.ntpNames))
+    {
+      logWarn("NTP server %s left out during the deep sleep", ntpServers[n]);
+      continue;
+    }
+    memcpy(rtc.ntpNames + length, ntpServers[n], size);
+    length += size;
+  }
+  memset(rtc.ntpNames + length, 0, sizeof(rtc.ntpNames) - length);
+}
+
+static void restoreNtpNames()
+{
+  const char *name = rtc.ntpNames;
+  const char *end = rtc.ntpNames + sizeof(rtc.ntpNames);
+
+  strlcpy(ntpServer, name, sizeof(ntpServer));
+  name += strnlen(name, end - name) + 1;
+
+  memset(ntpServers, 0, sizeof(ntpServers));
+  for (uint8_t n = 0; n < NtpMaxServers - 1 && name < end && *name; n++)
+  {
+    strlcpy(ntpServers[n], name, sizeof(ntpServers[n]));
+    name += strnlen(name, end - name) + 1;
+  }
+}
+
+static void storeConfig()
+{
+  memcpy(rtc.channels, channels, sizeof(rtc.channels));
+  rtc.channelCount = channelCount;
+  rtc.burst = burstConfig;
+  storeNtpNames();
+  rtc.scheduleMinutes = scheduleMinutes;
+  rtc.nextLeapSecond = nextLeapSecond(time(nullptr));
+}
+
+static void restoreConfig()
+{
+  memcpy(channels, rtc.channels, sizeof(channels));
+  channelCount = rtc.channelCount;
+  burstConfig = rtc.burst;
+  restoreNtpNames();
+  scheduleMinutes = rtc.scheduleMinutes;
+  if (rtc.nextLeapSecond)
+    addLeapSecond((time_t)rtc.nextLeapSecond);
+}
+
+static int64_t wakeTargetUs()
+{
+  return (rtc.nextBurst - rtc.burst.headPulses - WakeLeadSeconds) * 1000000LL;
+}
+
+/**
+ * Store the state and deep sleep until the wall clock reaches wakeEpochUs (or as long as possible).
+ */
+static void deepSleepUntil(int64_t wakeEpochUs)
+{
+  const int64_t now = wallClockUs();
+  const uint64_t maxUs = ESP.deepSleepMax() / 100 * DeepSleepMaxPercent;
+
+  // The RTC clock runs off by driftPpm, ask for the length which lasts the wanted time
+  uint64_t sleepUs = wakeEpochUs > now ? (uint64_t)((wakeEpochUs - now) / (1.0 + rtc.driftPpm * 1e-6)) : 0;
+  const bool last = sleepUs <= maxUs;
+  if (!last)
+    sleepUs = maxUs;
+  if (sleepUs < MinDeepSleepUs)
+    sleepUs = MinDeepSleepUs;
+
+  rtc.magic = RtcStateMagic;
+  rtc.sleepEpochUs = now;
+  rtc.sleepUs = sleepUs;
+  rtc.sleptSinceSyncUs += sleepUs;
+  rtc.crc = stateCrc(rtc);
+  ESP.rtcUserMemoryWrite(RtcStateBlock, (uint32_t *)&rtc, sizeof(rtc));
+
+  logInfo("deep sleep for %u s (drift %d ppm)", (uint32_t)(sleepUs / 1000000), (int)rtc.driftPpm);
+  flushConfig();
+  flushLog();
+
+  // Only the wake up for the burst needs the radio
+  ESP.deepSleep(sleepUs, last ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+}
+
+void setScheduleMinutes(long minutes)
+{
+  if (minutes <= 0)
+    scheduleMinutes = 0;
+  else
+    scheduleMinutes = constrain(minutes, MinScheduleMinutes, MaxScheduleMinutes);
+}
+
+bool resumeFromDeepSleep()
+{
+  if (ESP.getResetInfoPtr()->reason != REASON_DEEP_SLEEP_AWAKE)
+    return false;
+
+  if (!ESP.rtcUserMemoryRead(RtcStateBlock, (uint32_t *)&rtc, sizeof(rtc)) || rtc.magic != RtcStateMagic ||
+      rtc.crc != stateCrc(rtc) || rtc.scheduleMinutes == 0)
+  {
+    memset(&rtc, 0, sizeof(rtc));
+    return false;
+  }
+
+  restoreConfig();
+
+  // The time the sleep began plus its length on the RTC clock corrected by the drift, and the boot so far
+  estimateMicros = micros64();
+  estimateEpochUs = rtc.sleepEpochUs + (int64_t)(rtc.sleepUs * (1.0 + rtc.driftPpm * 1e-6)) + estimateMicros;
+  estimatePending = true;
+  resumed = true;
+
+  const struct timeval tv = {(time_t)(estimateEpochUs / 1000000LL), (suseconds_t)(estimateEpochUs % 1000000LL)};
+  settimeofday(&tv, nullptr);
+
+  logInfo("resumed from deep sleep, next burst in %d s", (int)(rtc.nextBurst - tv.tv_sec));
+
+  // A wake up in between of a chained sleep
+  if (wakeTargetUs() - estimateEpochUs > WakeLeadSeconds * 1000000LL)
+    deepSleepUntil(wakeTargetUs());
+
+  return true;
+}
+
+bool scheduledWake()
+{
+  return resumed;
+}
+
+void quickSync()
+{
+  setTZ(channels[0].timezone);
+
+  // WiFiManager left the credentials in the SDK config
+  WiFi.mode(WIFI_STA);
+  WiFi.hostname(HOSTNAME);
+  WiFi.begin();
+
+  unsigned long start = millis();
+  while (WiFi.status() != WL_CONNECTED && millis() - start < QuickConnectTimeoutMs)
+    delay(10);
+
+  start = millis();
+  requestNtpPoll();
+  while (estimatePending && WiFi.status() == WL_CONNECTED && millis() - start < QuickSyncTimeoutMs)
+  {
+    serviceNtpClient();
+    delay(10);
+  }
+
+  if (estimatePending)
+    logWarn("no time sync, sending the estimated time");
+}
+
+void scheduleTimeSynced()
+{
+  if (estimatePending && rtc.sleptSinceSyncUs > 0)
+  {
+    // The estimate drifted away by the error of the RTC clock over all sleeps since the last sync
+    const int64_t errorUs = wallClockUs() - (estimateEpochUs + (int64_t)(micros64() - estimateMicros));
+
+    rtc.driftPpm += DriftGain * (float)errorUs * 1e6f / (float)rtc.sleptSinceSyncUs;
+    rtc.driftPpm = constrain(rtc.driftPpm, -MaxDriftPpm, MaxDriftPpm);
+
+    logInfo("estimated time off by %d ms, drift %d ppm", (int)(errorUs / 1000), (int)rtc.driftPpm);
+  }
+
+  estimatePending = false;
+  rtc.sleptSinceSyncUs = 0;
+}
+
+time_t scheduledFirstFrame()
+{
+  return resumed ? (time_t)rtc.nextBurst : 0;
+}
+
+bool burstAllowed()
+{
+  return scheduleMinutes == 0 || !queued;
+}
+
+void burstQueued(time_t firstFrame)
+{
+  queued = true;
+  queuedFirstFrame = firstFrame;
+}
+
+void serviceSchedule()
+{
+  if (scheduleMinutes == 0 || !queued || isTransmitting())
+    return;
+
+  // The burst is over, the next one follows after the schedule interval
+  storeConfig();
+  rtc.nextBurst = queuedFirstFrame + scheduleMinutes * 60L;
+  deepSleepUntil(wakeTargetUs());
+}
@@ -0,0 +1,307 @@
+#include "scheduler.h"
+#include "channels.h"
+#include "config.h"
+#include "carrier.h"
+#include "bitstream.h"
+#include "phase_carrier.h"
+#include "spsc_queue.h"
+#include "memory_stats.h"
+
+#include <sys/time.h>
+
+/**
+ * Edge scheduler
+ *
+ * Instead of polling every 100 msec, hardware timer1 is armed for the exact time of the next edge of any channel.
+ * Every channel walks the waveforms of the symbols in its pulse array, shifted by its edge offset, and all edges
+ * falling into the same interrupt are written together to GPO. A carrier channel switches the amplitude of the
+ * synthesized carrier instead, a bitstream or phase carrier channel is not handled here at all but rendered into its
+ * DMA buffers (see bitstream.cpp and phase_carrier.cpp).
+ * Transmissions are handed over from loop() through a lock-free queue: the timer interrupt takes the front one when
+ * the previous one has ended and only returns its slot once the transmission is over, so the producer never writes
+ * symbols an interrupt is still reading.
+ * Note: timer1 is also used by analogWrite()/tone()/Servo, which must not be used.
+ */
+
+static EdgeState edgeStates[MaxChannels];
+
+static SpscQueue<Transmission, TransmissionQueueSize> transmissionQueue;
+// Consumer side: the transmission being sent and when the last edge of any channel is over
+static Transmission *current = nullptr;
+static uint64_t currentEnd = 0;
+// The timer interrupt is running (or about to), only cleared by the interrupt itself
+static volatile bool timerArmed = false;
+// micros64() time the timer interrupt is armed for (an edge or the end of the transmission), 0 while disarmed
+static uint64_t armedMicros = 0;
+
+// Pins of all channels and their current output level, written in one go to GPO
+static uint32_t channelPinMask = 0;
+static uint32_t channelLevels = 0;
+static uint32_t invertedMask = 0;
+
+static void IRAM_ATTR scheduleNextEdge(EdgeState &state, const DcfChannel &channel)
+{
+  while (state.pulse < state.pulseCount)
+  {
+    const SymbolWaveform &waveform = Protocol::Waveforms[state.pulses[state.pulse]];
+
+    if (state.edge < waveform.edges)
+    {
+      state.nextEdge = state.start + (uint64_t)state.pulse * 1000000 + waveform.edgeMs[state.edge] * 1000UL;
+      return;
+    }
+
+    // All edges of this second are done (or there are none at all, e.g. a missing pulse)
+    state.pulse++;
+    state.edge = 0;
+  }
+
+  state.done = true;
+}
+
+void IRAM_ATTR resetEdgeState(EdgeState &state, const DcfChannel &channel, const Transmission &transmission, uint8_t index)
+{
+  state.pulses = transmission.pulses[index];
+  state.pulseCount = transmission.pulseCount;
+  state.start = transmission.startMicros + channel.edgeOffsetUs;
+  state.pulse = 0;
+  state.edge = 0;
+  state.inPulse = false;
+  state.done = false;
+  scheduleNextEdge(state, channel);
+}
+
+void IRAM_ATTR advanceEdgeState(EdgeState &state, const DcfChannel &channel)
+{
+  state.inPulse = !state.inPulse;
+  state.edge++;
+
+  scheduleNextEdge(state, channel);
+}
+
+static void IRAM_ATTR armEdgeTimer(uint64_t nextEdge)
+{
+  const int64_t delta = (int64_t)(nextEdge - micros64());
+  uint32_t ticks;
+
+  armedMicros = nextEdge;
+
+  if (delta < 2)
+    ticks = 10; // Already late, fire as soon as possible
+  else if (delta >= MaxTimerTicks / TimerTicksPerUs)
+    ticks = MaxTimerTicks; // Too far away, the interrupt just re-arms the timer
+  else
+    ticks = delta * TimerTicksPerUs;
+
+  timer1_write(ticks);
+}
+
+static void IRAM_ATTR beginTransmission(Transmission &transmission)
+{
+  for (uint8_t n = 0; n < channelCount; n++)
+  {
+    EdgeState &state = edgeStates[n];
+
+    // Rendered into the DMA stream, no timer interrupts needed
+    if constexpr (hasBackend(BitstreamOutput))
+    {
+      if (channels[n].backend == BitstreamOutput)
+      {
+        bitstreamStart(transmission, n);
+        state.done = true;
+        continue;
+      }
+    }
+    if constexpr (hasBackend(PhaseCarrierOutput))
+    {
+      if (channels[n].backend == PhaseCarrierOutput)
+      {
+        phaseCarrierStart(transmission, n);
+        state.done = true;
+        continue;
+      }
+    }
+
+    resetEdgeState(state, channels[n], transmission, n);
+  }
+
+  // Covers every channel including the largest edge offset
+  currentEnd = transmission.startMicros + transmission.pulseCount * 1000000ULL + MaxEdgeOffsetUs;
+}
+
+static void IRAM_ATTR onEdgeTimer()
+{
+  const uint64_t now = micros64() + EdgeCoalesceUs;
+  uint64_t nextEdge = UINT64_MAX;
+  uint32_t activeMask = 0;
+  uint32_t idleMask = 0;
+
+  sampleInterruptStack();
+
+  if (current && now >= currentEnd)
+  {
+    // Nothing reads the symbols any more, give the slot back
+    transmissionQueue.pop();
+    current = nullptr;
+  }
+
+  if (!current)
+  {
+    current = transmissionQueue.front();
+    if (!current)
+    {
+      timerArmed = false;
+      armedMicros = 0;
+      timer1_disable();
+      return;
+    }
+
+    beginTransmission(*current);
+  }
+
+  for (uint8_t n = 0; n < channelCount; n++)
+  {
+    EdgeState &state = edgeStates[n];
+
+    while (!state.done && state.nextEdge <= now)
+    {
+      const uint32_t pinBit = gpioOnly() || channels[n].backend == GpioOutput ? 1UL << channels[n].pin : 0;
+
+      if (state.inPulse)
+        idleMask |= pinBit;
+      else
+        activeMask |= pinBit;
+
+      advanceEdgeState(state, channels[n]);
+
+      if constexpr (hasBackend(CarrierOutput))
+      {
+        if (channels[n].backend == CarrierOutput)
+          carrierSetReduced(state.inPulse);
+      }
+    }
+
+    if (!state.done && state.nextEdge < nextEdge)
+      nextEdge = state.nextEdge;
+  }
+
+  if (activeMask | idleMask)
+  {
+    // Idle is high and active is low, unless the channel is inverted
+    channelLevels |= (idleMask & ~invertedMask) | (activeMask & invertedMask);
+    channelLevels &= ~((activeMask & ~invertedMask) | (idleMask & invertedMask));
+
+    GPO = (GPO & ~channelPinMask) | channelLevels;
+  }
+
+  // Wake up at the end of the transmission to release it, even if all edges are done
+  armEdgeTimer(nextEdge < currentEnd ? nextEdge : currentEnd);
+}
+
+Transmission *reserveTransmission()
+{
+  return transmissionQueue.reserve();
+}
+
+void queueTransmission()
+{
+  transmissionQueue.commit();
+
+  // The interrupt only disarms itself after finding the queue empty, so it either sees this transmission already
+  // or has to be woken up here
+  if (!timerArmed)
+  {
+    timerArmed = true;
+    armedMicros = micros64() + EdgeCoalesceUs;
+    timer1_enable(TIM_DIV16, TIM_EDGE, TIM_SINGLE);
+    timer1_write(TimerTicksPerUs * EdgeCoalesceUs);
+  }
+}
+
+bool isTransmitting()
+{
+  return !transmissionQueue.empty();
+}
+
+uint64_t nextEdgeMicros()
+{
+  const uint32_t saved = xt_rsil(15);
+  const uint64_t next = armedMicros;
+  xt_wsr_ps(saved);
+
+  return next;
+}
+
+uint64_t wallClockToMicros(time_t wallClock)
+{
+  struct timeval tv;
+  const uint64_t nowMicros = micros64();
+
+  gettimeofday(&tv, nullptr);
+
+  return nowMicros + (int64_t)(wallClock - tv.tv_sec) * 1000000 - tv.tv_usec;
+}
+
+/**
+ * Start the I2S based backend of a channel (only one channel can have one).
+ */
+static void setupI2sOutput(const DcfChannel &channel)
+{
+  if constexpr (hasBackend(CarrierOutput))
+  {
+    // The carrier starts unmodulated on the I2S data pin
+    if (channel.backend == CarrierOutput)
+      setupCarrier();
+  }
+  if constexpr (hasBackend(BitstreamOutput))
+  {
+    // The idle level is streamed from the I2S data pin right away
+    if (channel.backend == BitstreamOutput)
+      setupBitstream(channel);
+  }
+  if constexpr (hasBackend(PhaseCarrierOutput))
+  {
+    // Unmodulated carrier until the first transmission
+    if (channel.backend == PhaseCarrierOutput)
+      setupPhaseCarrier(channel);
+  }
+}
+
+void setupDcf()
+{
+  channelPinMask = 0;
+  channelLevels = 0;
+  invertedMask = 0;
+
+  for (uint8_t n = 0; n < channelCount; n++)
+  {
+    DcfChannel &channel = channels[n];
+    const uint32_t pinBit = 1UL << channel.pin;
+
+    if constexpr (!gpioOnly())
+    {
+      if (channel.backend != GpioOutput)
+      {
+        setupI2sOutput(channel);
+        continue;
+      }
+    }
+
+    // DCF output pin
+    pinMode(channel.pin, channel.mode == OpenDrain ? OUTPUT_OPEN_DRAIN : OUTPUT);
+    channelPinMask |= pinBit;
+
+    // Start with the pulse level, the first head pulse releases it
+    if (channel.inverted)
+    {
+      invertedMask |= pinBit;
+      channelLevels |= pinBit;
+    }
+  }
+
+  GPO = (GPO & ~channelPinMask) | channelLevels;
+
+  // Handle DCF pulses
+  timer1_isr_init();
+  timer1_attachInterrupt(onEdgeTimer);
+}
@@ -0,0 +1,80 @@
+#include "sntp_packet.h"
+#include "ntp_select.h"
+
+#include <string.h>
+
+/**
+ * SNTPv4 answers (RFC 4330, header fields as in RFC 5905 7.3)
+ *
+ * The answer is built in the buffer of the request: the version and poll interval stay, the transmit timestamp of
+ * the client becomes the originate timestamp.
+ */
+
+#define ModeClient 3
+#define ModeServer 4
+#define StratumUnsynchronized 16
+
+static void putUint32(uint8_t *out, uint32_t value)
+{
+  out[0] = value >> 24;
+  out[1] = value >> 16;
+  out[2] = value >> 8;
+  out[3] = value;
+}
+
+static void putTimestamp(uint8_t *out, int64_t epochUs)
+{
+  putUint32(out, (uint32_t)(epochUs / 1000000) + NtpUnixOffset);
+  putUint32(out + 4, (uint32_t)(((uint64_t)(epochUs % 1000000) << 32) / 1000000));
+}
+
+// NTP short format, 16.16 seconds
+static void putShort(uint8_t *out, int64_t us)
+{
+  putUint32(out, (uint32_t)((uint64_t)(us < 0 ? 0 : us) * 65536 / 1000000));
+}
+
+bool sntpClientRequest(const uint8_t *packet, size_t length)
+{
+  return length >= SntpPacketBytes && (packet[0] & 7) == ModeClient;
+}
+
+void buildSntpAnswer(uint8_t *packet, const SntpUpstream &upstream, uint8_t leap, int64_t referenceUs,
+                     int64_t receivedUs, int64_t sinceSyncUs)
+{
+  const uint8_t version = (packet[0] >> 3) & 7;
+  // Stratum 15 upstream would make us 16, unsynchronized as well
+  const bool synced = upstream.stratum > 0 && upstream.stratum < StratumUnsynchronized - 1;
+
+  packet[0] = (synced ? leap : SntpLeapUnsynchronized) << 6 | version << 3 | ModeServer;
+  packet[1] = synced ? upstream.stratum + 1 : StratumUnsynchronized;
+  // packet[2]: poll interval, copied from the request
+  packet[3] = (uint8_t)SntpPrecision;
+
+  // Root dispersion grows with the time since the last sync
+  putShort(packet + 4, synced ? upstream.rootDelayUs : 0);
+  putShort(packet + 8, (synced ? upstream.rootDispersionUs : 0) + SntpDispersionUs +
+                           sinceSyncUs * SntpDriftPpm / 1000000);
+
+  if (synced)
+  {
+    packet[12] = upstream.address;
+    packet[13] = upstream.address >> 8;
+    packet[14] = upstream.address >> 16;
+    packet[15] = upstream.address >> 24;
+  }
+  else
+    memcpy(packet + 12, SntpKissCode, 4);
+
+  memcpy(packet + 24, packet + 40, 8);
+  if (synced)
+    putTimestamp(packet + 16, referenceUs);
+  else
+    memset(packet + 16, 0, 8);
+  putTimestamp(packet + 32, receivedUs);
+}
+
+void stampSntpAnswer(uint8_t *packet, int64_t transmitUs)
+{
+  putTimestamp(packet + 40, transmitUs);
+}
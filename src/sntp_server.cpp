@@ -0,0 +1,122 @@
+#include "sntp_server.h"
+#include "config.h"
+#include "fleet.h"
+#include "frame_cache.h"
+#include "leap.h"
+#include "log.h"
+#include "ntp_client.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiUdp.h>
+#include <sys/time.h>
+
+/**
+ * SNTPv4 server (RFC 4330)
+ *
+ * Answers the clients from the same system clock the transmissions are scheduled from. The receive timestamp is
+ * taken as soon as the request is seen and the transmit timestamp right before the answer is handed to lwIP, with
+ * nothing but a few stores in between. The answer is built in a static buffer, no heap allocation besides the
+ * packet buffers of lwIP itself. Stratum and reference id come from the server the clock follows (the NTP system
+ * peer or the fleet master), see sntp_packet.cpp.
+ */
+
+bool sntpServerEnabled = false;
+
+// Constructed on first use: a variant without the server must not link the UDP code through a static constructor
+static WiFiUDP &sntpUdp()
+{
+  static WiFiUDP udp;
+  return udp;
+}
+
+static bool listening = false;
+static uint8_t packet[SntpPacketBytes];
+
+// Wall clock of the last sync, 0 = never
+static int64_t referenceUs = 0;
+static uint64_t referenceMicros = 0;
+
+static int64_t wallClockUs()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Leap indicator, looked up once a day and after every sync
+static time_t checkedDay = 0;
+static uint8_t indicator = SntpLeapNone;
+
+static uint8_t leapIndicator(time_t now)
+{
+  if (now / 86400 != checkedDay)
+  {
+    checkedDay = now / 86400;
+    indicator = leapSecondThisMonth(now) ? SntpLeapInsert : SntpLeapNone;
+  }
+
+  return indicator;
+}
+
+void sntpServerTimeSynced()
+{
+  referenceUs = wallClockUs();
+  referenceMicros = micros64();
+  checkedDay = 0;
+}
+
+static void answer(int64_t receivedUs)
+{
+  // A follower is synchronized by the master, everything else by the NTP system peer
+  SntpUpstream upstream;
+  if (!(Variant::Fleet && fleetRole == FleetFollower ? fleetUpstream(upstream) : ntpUpstream(upstream)) ||
+      referenceUs < MinValidTime * 1000000LL)
+    upstream.stratum = 0;
+
+  buildSntpAnswer(packet, upstream, leapIndicator(receivedUs / 1000000), referenceUs, receivedUs,
+                  micros64() - referenceMicros);
+
+  if (!sntpUdp().beginPacket(sntpUdp().remoteIP(), sntpUdp().remotePort()))
+    return;
+
+  stampSntpAnswer(packet, wallClockUs());
+  sntpUdp().write(packet, sizeof(packet));
+  sntpUdp().endPacket();
+}
+
+void serviceSntpServer()
+{
+  if (!sntpServerEnabled)
+    return;
+
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    listening = false;
+    return;
+  }
+
+  if (!listening)
+  {
+    listening = sntpUdp().begin(SntpPort);
+    logInfo("%s the SNTP server", listening ? "started" : "failed to start");
+    if (!listening)
+      return;
+  }
+
+  for (uint8_t n = 0; n < SntpMaxRequestsPerPass; n++)
+  {
+    const int size = sntpUdp().parsePacket();
+    if (size <= 0)
+      return;
+
+    const int64_t receivedUs = wallClockUs();
+
+    // Only plain client requests, extension fields are not read
+    if (size < SntpPacketBytes || sntpUdp().read(packet, sizeof(packet)) != SntpPacketBytes ||
+        !sntpClientRequest(packet, SntpPacketBytes) || time(nullptr) < MinValidTime)
+      continue;
+
+    answer(receivedUs);
+  }
+}
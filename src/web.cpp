@@ -0,0 +1,22 @@
+#include "web.h"
+#include "config.h"
+#include "log.h"
+#include "memory_stats.h"
+
+ESP8266WebServer webServer(80);
+
+void setupWebServer()
+{
+  webServer.onNotFound([]()
+                       { webServer.send(404, "text/plain", "Not found"); });
+  webServer.begin();
+
+  logInfo("HTTP server started");
+}
+
+void handleWebServer()
+{
+  HeapScope heapScope(HeapWeb);
+
+  webServer.handleClient();
+}
@@ -0,0 +1,225 @@
+#include "wifi_portal.h"
+#include "config.h"
+#include "channels.h"
+#include "variant.h"
+#include "memory_stats.h"
+#include "web.h"
+#include "log.h"
+
+#include <ESP8266WiFi.h>
+#include <WiFiManager.h>
+
+/**
+ * WiFi connection and config portal
+ *
+ * A single WiFiManager lives for the whole uptime, its portal runs non-blocking: serviceWiFi() serves it from
+ * loop(), so the edges keep going while the unit is reconfigured. The parameters are created once and filled
+ * from the settings every time the portal opens. The portal serves port 80 itself, the own web server is stopped
+ * while it is open.
+ */
+
+static WiFiManager wifiManager;
+
+// id/name, placeholder/prompt, value (set when the portal opens), length
+static WiFiManagerParameter ntpServerParameter("ntp server", "NTP Server", "", 40);
+static WiFiManagerParameter timezoneParameter("timezone", "timezone", "", 40);
+static WiFiManagerParameter timeCorrectionOffsetParameter("time correction offset", "time correction offset in seconds", "", 5);
+static WiFiManagerParameter edgeOffsetParameter("edge offset", "pulse offset in microseconds (negative = earlier)", "", 9);
+static WiFiManagerParameter burstMinutesParameter("burst minutes", "minutes per transmission", "", 3);
+static WiFiManagerParameter burstGapParameter("burst gap", "seconds between transmissions", "", 4);
+static WiFiManagerParameter otaPasswordParameter("ota password", "OTA password", "", 32);
+static WiFiManagerParameter otaPortParameter("ota port", "OTA port", "", 5);
+
+static bool connected = false;
+static bool portalActive = false;
+static unsigned long disconnectedSince = 0;
+
+/**
+ * Callback notifying us of the need to save config
+ */
+static void saveConfigCallback()
+{
+  logDebug("should save config");
+
+  shouldSaveConfig = true;
+}
+
+static void setParameter(WiFiManagerParameter &parameter, long value)
+{
+  char buffer[12];
+
+  ltoa(value, buffer, 10);
+  parameter.setValue(buffer, parameter.getValueLength());
+}
+
+// The portal shows the current settings, they may have changed since it was open the last time
+static void fillParameters()
+{
+  ntpServerParameter.setValue(ntpServer, ntpServerParameter.getValueLength());
+  timezoneParameter.setValue(channels[0].timezone, timezoneParameter.getValueLength());
+  setParameter(timeCorrectionOffsetParameter, channels[0].timeCorrectionOffset);
+  setParameter(edgeOffsetParameter, channels[0].edgeOffsetUs);
+  setParameter(burstMinutesParameter, burstConfig.minutes);
+  setParameter(burstGapParameter, burstConfig.gapSeconds);
+  otaPasswordParameter.setValue(otaPassword, otaPasswordParameter.getValueLength());
+  setParameter(otaPortParameter, otaPort);
+}
+
+static void applyParameters()
+{
+  ConfigSnapshot before;
+  takeConfigSnapshot(before);
+
+  strlcpy(ntpServer, ntpServerParameter.getValue(), sizeof(ntpServer));
+  strlcpy(channels[0].timezone, timezoneParameter.getValue(), sizeof(channels[0].timezone));
+  channels[0].timeCorrectionOffset = atoi(timeCorrectionOffsetParameter.getValue());
+  channels[0].edgeOffsetUs = validEdgeOffset(atol(edgeOffsetParameter.getValue()));
+  setBurstConfig(atoi(burstMinutesParameter.getValue()), burstConfig.headPulses, burstConfig.tailPulses,
+                 atol(burstGapParameter.getValue()));
+  if (Variant::Ota)
+  {
+    strlcpy(otaPassword, otaPasswordParameter.getValue(), sizeof(otaPassword));
+    otaPort = atoi(otaPortParameter.getValue());
+  }
+
+  logDebug("ntp server: %s, timezone: %s", ntpServer, channels[0].timezone);
+  logDebug("time correction offset: %d s, pulse offset: %d us", channels[0].timeCorrectionOffset,
+           channels[0].edgeOffsetUs);
+  logDebug("burst minutes: %u, burst gap: %u s, ota port: %u", burstConfig.minutes, burstConfig.gapSeconds, otaPort);
+
+  // Applied live like a PUT /config, then saved to FS
+  const uint8_t changes = configChanges(before);
+  if (changes)
+  {
+    notifyConfigChanged(changes);
+    saveConfig();
+  }
+}
+
+// Called after WiFiManager may have opened or closed the portal
+static void portalChanged()
+{
+  const bool active = wifiManager.getConfigPortalActive();
+
+  if (active == portalActive)
+    return;
+  portalActive = active;
+
+  if (active)
+  {
+    logInfo("config portal %s open", HOSTNAME);
+  }
+  else
+  {
+    webServer.begin();
+    logInfo("config portal closed");
+  }
+}
+
+void setupWiFi()
+{
+  HeapScope heapScope(HeapWifi);
+
+  wifiManager.setSaveConfigCallback(saveConfigCallback);
+  wifiManager.setSaveParamsCallback(saveConfigCallback);
+
+  wifiManager.addParameter(&ntpServerParameter);
+  wifiManager.addParameter(&timezoneParameter);
+  wifiManager.addParameter(&timeCorrectionOffsetParameter);
+  wifiManager.addParameter(&edgeOffsetParameter);
+  wifiManager.addParameter(&burstMinutesParameter);
+  wifiManager.addParameter(&burstGapParameter);
+  if (Variant::Ota)
+  {
+    wifiManager.addParameter(&otaPasswordParameter);
+    wifiManager.addParameter(&otaPortParameter);
+  }
+
+  // The portal is served by serviceWiFi(), it closes after the timeout and opens again if still not connected
+  wifiManager.setConfigPortalBlocking(false);
+  wifiManager.setConfigPortalTimeout(PortalTimeoutSeconds);
+
+#ifdef DEBUG
+  wifiManager.setDebugOutput(true);
+#else
+  wifiManager.setDebugOutput(false);
+#endif
+
+// Set WiFi DNS hostname
+#ifdef ESP8266
+  WiFi.hostname(HOSTNAME);
+#elif ESP32
+  WiFi.setHostname(HOSTNAME);
+#else
+#warning("Cannot set hostname for unknown chip (it is not a ESP8266 or ESP32!)")
+#endif
+
+  // Fetches ssid and pass from eeprom and tries to connect, if it does not connect the portal is opened
+  fillParameters();
+  webServer.stop();
+  if (wifiManager.autoConnect(HOSTNAME))
+    webServer.begin();
+  disconnectedSince = millis();
+  portalChanged();
+}
+
+void startConfigPortal()
+{
+  if (portalActive)
+    return;
+
+  HeapScope heapScope(HeapWifi);
+
+  fillParameters();
+  webServer.stop();
+  wifiManager.startConfigPortal(HOSTNAME);
+  portalChanged();
+}
+
+bool configPortalActive()
+{
+  return portalActive;
+}
+
+void serviceWiFi()
+{
+  HeapScope heapScope(HeapWifi);
+
+  if (portalActive)
+  {
+    wifiManager.process();
+    portalChanged();
+  }
+
+  if (shouldSaveConfig)
+  {
+    applyParameters();
+    shouldSaveConfig = false;
+  }
+
+  const bool nowConnected = WiFi.status() == WL_CONNECTED;
+  if (nowConnected != connected)
+  {
+    connected = nowConnected;
+    disconnectedSince = millis();
+
+    if (connected)
+    {
+      const IPAddress address = WiFi.localIP();
+      logInfo("WiFi connected, IP address %u.%u.%u.%u", address[0], address[1], address[2], address[3]);
+    }
+    else
+    {
+      // Also after the radio was woken, the station reconnects with the saved credentials
+      logInfo("WiFi disconnected");
+      WiFi.begin();
+    }
+  }
+
+  if (!connected && !portalActive && millis() - disconnectedSince > PortalAfterDisconnectMs)
+  {
+    logWarn("no WiFi connection, opening the config portal");
+    startConfigPortal();
+    disconnectedSince = millis();
+  }
+}
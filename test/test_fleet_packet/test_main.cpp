@@ -0,0 +1,239 @@
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "fleet_packet.h"
+
+/**
+ * Fleet packets between a master and two follower instances: the master's packets are encoded, sent over UDP on
+ * the loopback interface to both followers, decoded and checked for staleness and protocol as in fleet.cpp.
+ */
+
+#define Followers 2
+
+struct Follower
+{
+  int socket;
+  sockaddr_in address;
+  FleetFollowerState state;
+  FleetPacket packet;
+};
+
+static Follower followers[Followers];
+static int masterSocket = -1;
+
+static void fillPacket(FleetPacket &packet, uint32_t sequence, int64_t sentEpochUs)
+{
+  memset(&packet, 0, sizeof(packet));
+  strcpy(packet.protocol, "DCF77");
+  packet.carrierFrequency = 77500;
+  packet.sequence = sequence;
+  packet.sentEpochUs = sentEpochUs;
+  strcpy(packet.timezone, "CET-1CEST,M3.5.0,M10.5.0/3");
+  packet.timeCorrectionOffset = -60;
+  packet.stratum = 3;
+  packet.frameCount = FleetFrames;
+
+  for (uint8_t n = 0; n < FleetFrames; n++)
+  {
+    FleetFrame &frame = packet.frames[n];
+
+    frame.minute = 1719791580LL - 3 * 60 + n * 60;
+    // The fourth frame is the minute before a leap second
+    frame.seconds = n == 3 ? 61 : 60;
+    for (uint8_t s = 0; s < frame.seconds; s++)
+      frame.symbols[s] = (s * 7 + n) % 3;
+  }
+}
+
+static void assertSamePacket(const FleetPacket &expected, const FleetPacket &actual)
+{
+  TEST_ASSERT_EQUAL_STRING(expected.protocol, actual.protocol);
+  TEST_ASSERT_EQUAL_UINT32(expected.carrierFrequency, actual.carrierFrequency);
+  TEST_ASSERT_EQUAL_UINT32(expected.sequence, actual.sequence);
+  TEST_ASSERT_EQUAL_INT64(expected.sentEpochUs, actual.sentEpochUs);
+  TEST_ASSERT_EQUAL_STRING(expected.timezone, actual.timezone);
+  TEST_ASSERT_EQUAL_INT(expected.timeCorrectionOffset, actual.timeCorrectionOffset);
+  TEST_ASSERT_EQUAL_UINT8(expected.stratum, actual.stratum);
+  TEST_ASSERT_EQUAL_UINT8(expected.frameCount, actual.frameCount);
+
+  for (uint8_t n = 0; n < expected.frameCount; n++)
+  {
+    TEST_ASSERT_EQUAL_INT64(expected.frames[n].minute, actual.frames[n].minute);
+    TEST_ASSERT_EQUAL_UINT8(expected.frames[n].seconds, actual.frames[n].seconds);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(expected.frames[n].symbols, actual.frames[n].symbols, expected.frames[n].seconds);
+    // Nothing left over behind a shorter frame
+    for (uint8_t s = actual.frames[n].seconds; s < FleetMaxFrameSeconds; s++)
+      TEST_ASSERT_EQUAL_UINT8(0, actual.frames[n].symbols[s]);
+  }
+}
+
+void setUp()
+{
+  const timeval timeout = {1, 0};
+
+  masterSocket = socket(AF_INET, SOCK_DGRAM, 0);
+  TEST_ASSERT_TRUE(masterSocket >= 0);
+
+  for (uint8_t n = 0; n < Followers; n++)
+  {
+    Follower &follower = followers[n];
+    socklen_t length = sizeof(follower.address);
+
+    memset(&follower, 0, sizeof(follower));
+    follower.socket = socket(AF_INET, SOCK_DGRAM, 0);
+    TEST_ASSERT_TRUE(follower.socket >= 0);
+    setsockopt(follower.socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    follower.address.sin_family = AF_INET;
+    follower.address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    follower.address.sin_port = 0;
+    TEST_ASSERT_EQUAL_INT(0, bind(follower.socket, (sockaddr *)&follower.address, sizeof(follower.address)));
+    getsockname(follower.socket, (sockaddr *)&follower.address, &length);
+  }
+}
+
+void tearDown()
+{
+  close(masterSocket);
+  for (uint8_t n = 0; n < Followers; n++)
+    close(followers[n].socket);
+}
+
+// Master side: encode and send to every follower
+static void sendPacket(const FleetPacket &packet)
+{
+  uint8_t buffer[FleetPacketBytes];
+  const size_t length = encodeFleetPacket(packet, buffer, sizeof(buffer));
+
+  TEST_ASSERT_GREATER_THAN(0, length);
+  for (uint8_t n = 0; n < Followers; n++)
+    TEST_ASSERT_EQUAL_INT(length, sendto(masterSocket, buffer, length, 0, (sockaddr *)&followers[n].address,
+                                         sizeof(followers[n].address)));
+}
+
+// Follower side: receive, decode and check the next packet
+static FleetAcceptance receivePacket(Follower &follower)
+{
+  uint8_t buffer[FleetPacketBytes];
+  const ssize_t length = recv(follower.socket, buffer, sizeof(buffer), 0);
+
+  TEST_ASSERT_GREATER_THAN(0, length);
+  if (!decodeFleetPacket(buffer, length, &follower.packet))
+    return FleetForeign;
+
+  return acceptFleetPacket(follower.packet, "DCF77", 77500, follower.state);
+}
+
+static void testRoundTrip()
+{
+  static FleetPacket sent;
+  static FleetPacket received;
+  uint8_t buffer[FleetPacketBytes];
+
+  fillPacket(sent, 7, 1719791400123456LL);
+  const size_t length = encodeFleetPacket(sent, buffer, sizeof(buffer));
+
+  TEST_ASSERT_GREATER_THAN(0, length);
+  TEST_ASSERT_LESS_OR_EQUAL(FleetPacketBytes, length);
+  TEST_ASSERT_TRUE(decodeFleetPacket(buffer, length, &received));
+  assertSamePacket(sent, received);
+
+  // Too small a buffer
+  TEST_ASSERT_EQUAL(0, encodeFleetPacket(sent, buffer, length - 1));
+}
+
+static void testLoopbackFollowers()
+{
+  static FleetPacket packet;
+  const int64_t start = 1719791400000000LL;
+
+  for (uint32_t sequence = 0; sequence < 3; sequence++)
+  {
+    fillPacket(packet, sequence, start + sequence * 10000000LL);
+    sendPacket(packet);
+
+    for (uint8_t n = 0; n < Followers; n++)
+    {
+      TEST_ASSERT_EQUAL(FleetAccepted, receivePacket(followers[n]));
+      assertSamePacket(packet, followers[n].packet);
+    }
+  }
+
+  // A duplicate and a late one are stale for every follower
+  fillPacket(packet, 2, start + 20000000LL);
+  sendPacket(packet);
+  fillPacket(packet, 1, start + 10000000LL);
+  sendPacket(packet);
+  for (uint8_t n = 0; n < Followers; n++)
+  {
+    TEST_ASSERT_EQUAL(FleetStale, receivePacket(followers[n]));
+    TEST_ASSERT_EQUAL(FleetStale, receivePacket(followers[n]));
+    TEST_ASSERT_EQUAL_UINT32(2, followers[n].state.sequence);
+  }
+
+  // A restarted master counts from 0 again, but sends later
+  fillPacket(packet, 0, start + 600000000LL);
+  sendPacket(packet);
+  for (uint8_t n = 0; n < Followers; n++)
+    TEST_ASSERT_EQUAL(FleetAccepted, receivePacket(followers[n]));
+
+  // The sequence wraps around
+  FleetFollowerState state = {true, 0xFFFFFFFFUL, start};
+  fillPacket(packet, 0, start);
+  TEST_ASSERT_EQUAL(FleetAccepted, acceptFleetPacket(packet, "DCF77", 77500, state));
+}
+
+static void testForeignPackets()
+{
+  static FleetPacket packet;
+  uint8_t buffer[FleetPacketBytes];
+  FleetFollowerState state = {false, 0, 0};
+
+  fillPacket(packet, 1, 1719791400000000LL);
+
+  // Another protocol or carrier
+  TEST_ASSERT_EQUAL(FleetForeign, acceptFleetPacket(packet, "MSF", 60000, state));
+  TEST_ASSERT_EQUAL(FleetForeign, acceptFleetPacket(packet, "DCF77", 60000, state));
+  TEST_ASSERT_FALSE(state.taken);
+
+  const size_t length = encodeFleetPacket(packet, buffer, sizeof(buffer));
+
+  // Truncated anywhere
+  for (size_t cut = 0; cut < length; cut += 7)
+    TEST_ASSERT_FALSE(decodeFleetPacket(buffer, cut, &packet));
+
+  // Another magic or version
+  buffer[0] = 'X';
+  TEST_ASSERT_FALSE(decodeFleetPacket(buffer, length, &packet));
+  buffer[0] = 'D';
+  buffer[4] = FleetVersion - 1;
+  TEST_ASSERT_FALSE(decodeFleetPacket(buffer, length, &packet));
+  buffer[4] = FleetVersion;
+  TEST_ASSERT_TRUE(decodeFleetPacket(buffer, length, &packet));
+
+  // Too many frames or seconds
+  buffer[FleetHeaderBytes - 1] = FleetFrames + 1;
+  TEST_ASSERT_FALSE(decodeFleetPacket(buffer, length, &packet));
+  buffer[FleetHeaderBytes - 1] = FleetFrames;
+  buffer[FleetHeaderBytes + 8] = FleetMaxFrameSeconds + 1;
+  TEST_ASSERT_FALSE(decodeFleetPacket(buffer, length, &packet));
+
+  fillPacket(packet, 1, 1719791400000000LL);
+  packet.frames[0].seconds = FleetMaxFrameSeconds + 1;
+  TEST_ASSERT_EQUAL(0, encodeFleetPacket(packet, buffer, sizeof(buffer)));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testRoundTrip);
+  RUN_TEST(testLoopbackFollowers);
+  RUN_TEST(testForeignPackets);
+  return UNITY_END();
+}
@@ -0,0 +1,194 @@
+#include <unity.h>
+
+#include "ntp_discipline.h"
+
+/**
+ * Poll interval and clock corrections of the NTP client against a simulated local clock: its error grows by its
+ * drift between the updates, the server offset is that error negated, and the corrections are applied to it.
+ */
+
+struct SimulatedClock
+{
+  NtpDiscipline discipline;
+  uint64_t nowUs;   // local monotonic time
+  int64_t errorUs;  // local clock minus true time
+  double driftPpm;  // local clock too fast by
+  int64_t jitterUs; // of the servers
+};
+
+static SimulatedClock simulated;
+
+void setUp()
+{
+  clearNtpDiscipline(simulated.discipline);
+  simulated.nowUs = 1000000;
+  simulated.errorUs = 0;
+  simulated.driftPpm = 0;
+  simulated.jitterUs = 50;
+}
+
+void tearDown()
+{
+}
+
+/**
+ * One update with the current error, the slew is applied completely (well before the next poll), then the clock
+ * runs until the next one.
+ */
+static NtpCorrection update()
+{
+  SimulatedClock &clock = simulated;
+  const NtpCorrection correction = updateNtpDiscipline(clock.discipline, -clock.errorUs, clock.jitterUs, clock.nowUs);
+
+  if (correction == NtpStep)
+    clock.errorUs = 0;
+  for (int64_t stepUs; (stepUs = nextNtpSlewStep(clock.discipline, 1000000)) != 0;)
+    clock.errorUs += stepUs;
+
+  const uint64_t intervalUs = 1000000ULL << clock.discipline.pollExponent;
+  clock.nowUs += intervalUs;
+  clock.errorUs += (int64_t)(clock.driftPpm * intervalUs / 1e6);
+
+  return correction;
+}
+
+static void testFirstUpdateSteps()
+{
+  NtpDiscipline &discipline = simulated.discipline;
+
+  TEST_ASSERT_EQUAL_UINT8(NtpMinPollExponent, discipline.pollExponent);
+  TEST_ASSERT_EQUAL(NtpStep, updateNtpDiscipline(discipline, 300, 50, 1000000));
+  TEST_ASSERT_TRUE(discipline.synced);
+
+  // Then only offsets beyond NtpStepOffsetUs
+  TEST_ASSERT_EQUAL(NtpSlew, updateNtpDiscipline(discipline, NtpStepOffsetUs, 50, 17000000));
+  TEST_ASSERT_EQUAL(NtpStep, updateNtpDiscipline(discipline, -NtpStepOffsetUs - 1, 50, 33000000));
+  TEST_ASSERT_FALSE(discipline.slewing);
+}
+
+static void testIgnoreWithinJitter()
+{
+  NtpDiscipline &discipline = simulated.discipline;
+
+  updateNtpDiscipline(discipline, 0, 50, 1000000);
+
+  // Within the jitter: left alone, no slew step due
+  TEST_ASSERT_EQUAL(NtpIgnore, updateNtpDiscipline(discipline, 40, 50, 17000000));
+  TEST_ASSERT_EQUAL(0, nextNtpSlewStep(discipline, 100000000));
+  TEST_ASSERT_EQUAL(NtpIgnore, updateNtpDiscipline(discipline, -40, 50, 33000000));
+
+  // Above the jitter, or however large the jitter, above NtpMaxIgnoredOffsetUs
+  TEST_ASSERT_EQUAL(NtpSlew, updateNtpDiscipline(discipline, 60, 50, 49000000));
+  TEST_ASSERT_EQUAL(NtpSlew, updateNtpDiscipline(discipline, NtpMaxIgnoredOffsetUs + 1, 5000, 65000000));
+}
+
+static void testSlewSteps()
+{
+  NtpDiscipline &discipline = simulated.discipline;
+
+  updateNtpDiscipline(discipline, 0, 50, 1000000);
+  TEST_ASSERT_EQUAL(NtpSlew, updateNtpDiscipline(discipline, -1100, 50, 17000000));
+
+  // NtpSlewRatePpm: a whole step takes 0.5 s
+  TEST_ASSERT_EQUAL(0, nextNtpSlewStep(discipline, 499999));
+  TEST_ASSERT_EQUAL(-NtpSlewStepUs, nextNtpSlewStep(discipline, 500000));
+  // Never more than a step, however late
+  TEST_ASSERT_EQUAL(-NtpSlewStepUs, nextNtpSlewStep(discipline, 60000000));
+  TEST_ASSERT_EQUAL(-NtpSlewStepUs, nextNtpSlewStep(discipline, 500000));
+  TEST_ASSERT_EQUAL(-NtpSlewStepUs, nextNtpSlewStep(discipline, 500000));
+  TEST_ASSERT_EQUAL(-100, discipline.slewUs);
+
+  // The rest is due as soon as the rate allows it
+  TEST_ASSERT_EQUAL(0, nextNtpSlewStep(discipline, 199999));
+  TEST_ASSERT_EQUAL(-100, nextNtpSlewStep(discipline, 200000));
+  TEST_ASSERT_FALSE(discipline.slewing);
+  TEST_ASSERT_EQUAL(0, nextNtpSlewStep(discipline, 100000000));
+}
+
+static void testPollRange()
+{
+  SimulatedClock &clock = simulated;
+  uint8_t highest = 0;
+
+  // A perfect clock: the interval grows every NtpPollHysteresis updates up to 2^10 s and stays there
+  for (uint8_t n = 0; n < 40; n++)
+  {
+    update();
+    if (clock.discipline.pollExponent > highest)
+      highest = clock.discipline.pollExponent;
+    TEST_ASSERT_GREATER_OR_EQUAL(NtpMinPollExponent, clock.discipline.pollExponent);
+    TEST_ASSERT_LESS_OR_EQUAL(NtpMaxPollExponent, clock.discipline.pollExponent);
+  }
+  TEST_ASSERT_EQUAL_UINT8(NtpMaxPollExponent, highest);
+  TEST_ASSERT_EQUAL_UINT8(NtpMaxPollExponent, clock.discipline.pollExponent);
+
+  // Offsets beyond the error budget halve it down to 2^4 s and not further
+  for (uint8_t n = 0; n < 10; n++)
+  {
+    clock.errorUs = 3 * NtpErrorBudgetUs;
+    TEST_ASSERT_EQUAL(NtpSlew, update());
+    TEST_ASSERT_GREATER_OR_EQUAL(NtpMinPollExponent, clock.discipline.pollExponent);
+  }
+  TEST_ASSERT_EQUAL_UINT8(NtpMinPollExponent, clock.discipline.pollExponent);
+
+  // A step starts over at 2^4 s
+  for (uint8_t n = 0; n < 12; n++)
+    update();
+  TEST_ASSERT_GREATER_THAN(NtpMinPollExponent, clock.discipline.pollExponent);
+  clock.errorUs = 2 * NtpStepOffsetUs;
+  TEST_ASSERT_EQUAL(NtpStep, update());
+  TEST_ASSERT_EQUAL_UINT8(NtpMinPollExponent, clock.discipline.pollExponent);
+}
+
+static void testDrift()
+{
+  SimulatedClock &clock = simulated;
+
+  // 2 ppm and 100 us jitter: the drift over 2^9 s (1 ms) plus the jitter exceeds half the budget, the interval
+  // settles at 2^8 s
+  clock.driftPpm = 2;
+  clock.jitterUs = 100;
+  for (uint8_t n = 0; n < 60; n++)
+  {
+    update();
+    TEST_ASSERT_LESS_THAN(NtpErrorBudgetUs, clock.errorUs < 0 ? -clock.errorUs : clock.errorUs);
+  }
+
+  TEST_ASSERT_INT_WITHIN(50, -2000, (int)(clock.discipline.frequencyPpm * 1000));
+  TEST_ASSERT_EQUAL_UINT8(8, clock.discipline.pollExponent);
+
+  // A fast drift (1.3 ms over 2^4 s) keeps it at the shortest
+  setUp();
+  clock.driftPpm = -80;
+  for (uint8_t n = 0; n < 30; n++)
+    update();
+  TEST_ASSERT_INT_WITHIN(4000, 80000, (int)(clock.discipline.frequencyPpm * 1000));
+  TEST_ASSERT_EQUAL_UINT8(NtpMinPollExponent, clock.discipline.pollExponent);
+}
+
+static void testDriftWithIgnoredOffsets()
+{
+  SimulatedClock &clock = simulated;
+
+  // The offsets stay within the jitter and are not corrected (192 us after 8 updates), the drift is still only
+  // what was added since the last update: 8 samples of exactly 1 ppm in the running average
+  clock.driftPpm = 1;
+  clock.jitterUs = NtpMaxIgnoredOffsetUs;
+  update();
+  for (uint8_t n = 0; n < 8; n++)
+    TEST_ASSERT_EQUAL(NtpIgnore, update());
+
+  TEST_ASSERT_INT_WITHIN(5, -900, (int)(clock.discipline.frequencyPpm * 1000));
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testFirstUpdateSteps);
+  RUN_TEST(testIgnoreWithinJitter);
+  RUN_TEST(testSlewSteps);
+  RUN_TEST(testPollRange);
+  RUN_TEST(testDrift);
+  RUN_TEST(testDriftWithIgnoredOffsets);
+  return UNITY_END();
+}
@@ -0,0 +1,265 @@
+#include <unity.h>
+
+#include <arpa/inet.h>
+#include <chrono>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "ntp_packet.h"
+#include "ntp_select.h"
+#include "sntp_packet.h"
+
+/**
+ * Requests and answers of the NTP client against fake servers on the loopback interface. The servers answer with
+ * the code of the SNTP server from their own clock, the local one shifted by their skew; one of them is far off and
+ * one sits behind an asymmetric path (the requests take 20 ms longer than the answers). The answers go through the
+ * clock filter and the selection as in ntp_client.cpp.
+ */
+
+struct FakeServer
+{
+  int64_t skewUs;      // its clock minus the local one
+  uint32_t outboundUs; // extra delay of the requests only
+  int socket;
+  sockaddr_in address;
+};
+
+#define TrueOffsetUs 1000
+#define SkewedServer 3
+#define AsymmetricServer 4
+#define ServerCount 5
+
+static FakeServer servers[ServerCount] = {
+    {TrueOffsetUs, 0, -1, {}},      {TrueOffsetUs + 150, 0, -1, {}}, {TrueOffsetUs - 100, 0, -1, {}},
+    {TrueOffsetUs + 80000, 0, -1, {}}, {TrueOffsetUs, 20000, -1, {}},
+};
+static int clientSocket = -1;
+
+// Stratum 1 upstream server of the fake servers (they announce stratum 2)
+static const SntpUpstream Upstream = {1, 0x0100007F, 2000, 1000};
+
+static int64_t wallClockUs()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, nullptr);
+  return (int64_t)tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+static uint64_t monotonicUs()
+{
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+static int openSocket(sockaddr_in &address)
+{
+  const timeval timeout = {1, 0};
+  socklen_t length = sizeof(address);
+  const int fd = socket(AF_INET, SOCK_DGRAM, 0);
+
+  TEST_ASSERT_TRUE(fd >= 0);
+  setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+  memset(&address, 0, sizeof(address));
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  TEST_ASSERT_EQUAL_INT(0, bind(fd, (sockaddr *)&address, sizeof(address)));
+  getsockname(fd, (sockaddr *)&address, &length);
+
+  return fd;
+}
+
+void setUp()
+{
+  sockaddr_in address;
+
+  clientSocket = openSocket(address);
+  for (uint8_t n = 0; n < ServerCount; n++)
+    servers[n].socket = openSocket(servers[n].address);
+}
+
+void tearDown()
+{
+  close(clientSocket);
+  for (uint8_t n = 0; n < ServerCount; n++)
+    close(servers[n].socket);
+}
+
+// Fake server: take the request, hold it for the outbound delay and answer from the skewed clock
+static void serve(const FakeServer &server, const SntpUpstream &upstream)
+{
+  uint8_t packet[SntpPacketBytes];
+  sockaddr_in from;
+  socklen_t length = sizeof(from);
+
+  TEST_ASSERT_EQUAL_INT(SntpPacketBytes, recvfrom(server.socket, packet, sizeof(packet), 0, (sockaddr *)&from,
+                                                  &length));
+  TEST_ASSERT_TRUE(sntpClientRequest(packet, sizeof(packet)));
+
+  if (server.outboundUs)
+    usleep(server.outboundUs);
+  const int64_t receivedUs = wallClockUs() + server.skewUs;
+  buildSntpAnswer(packet, upstream, SntpLeapNone, receivedUs - 60000000, receivedUs, 60000000);
+  stampSntpAnswer(packet, wallClockUs() + server.skewUs);
+
+  TEST_ASSERT_EQUAL_INT(SntpPacketBytes, sendto(server.socket, packet, sizeof(packet), 0, (sockaddr *)&from, length));
+}
+
+// Client: poll a server, false if its answer is rejected
+static bool poll(const FakeServer &server, const SntpUpstream &upstream, NtpAnswer &answer)
+{
+  uint8_t packet[NtpPacketBytes];
+  NtpRequest request;
+
+  buildNtpRequest(packet, wallClockUs(), request);
+  TEST_ASSERT_EQUAL_INT(NtpPacketBytes, sendto(clientSocket, packet, sizeof(packet), 0,
+                                               (const sockaddr *)&server.address, sizeof(server.address)));
+  serve(server, upstream);
+
+  const ssize_t length = recv(clientSocket, packet, sizeof(packet), 0);
+  const int64_t receivedUs = wallClockUs();
+  TEST_ASSERT_GREATER_THAN(0, length);
+
+  return parseNtpAnswer(packet, length, request, receivedUs, monotonicUs(), answer);
+}
+
+static void testRequest()
+{
+  uint8_t packet[NtpPacketBytes];
+  NtpRequest request;
+  const int64_t sentUs = 1719792000123456LL;
+
+  memset(packet, 0xFF, sizeof(packet));
+  buildNtpRequest(packet, sentUs, request);
+
+  // Client, version 4, nothing but the transmit timestamp
+  TEST_ASSERT_EQUAL_UINT8(4 << 3 | 3, packet[0]);
+  TEST_ASSERT_TRUE(sntpClientRequest(packet, sizeof(packet)));
+  for (uint8_t n = 1; n < 40; n++)
+    TEST_ASSERT_EQUAL_UINT8(0, packet[n]);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(request.cookie, packet + 40, 8);
+  TEST_ASSERT_EQUAL_INT64(sentUs, request.sentUs);
+
+  const uint32_t seconds = (uint32_t)packet[40] << 24 | packet[41] << 16 | packet[42] << 8 | packet[43];
+  TEST_ASSERT_EQUAL_UINT32((uint32_t)(sentUs / 1000000) + NtpUnixOffset, seconds);
+}
+
+static void testOffsetAndDelay()
+{
+  NtpAnswer answer;
+
+  // Symmetric path: the offset is the skew, within half the round trip
+  TEST_ASSERT_TRUE(poll(servers[0], Upstream, answer));
+  TEST_ASSERT_TRUE(answer.sample.valid);
+  TEST_ASSERT_LESS_THAN(5000, answer.sample.delayUs);
+  TEST_ASSERT_INT64_WITHIN(answer.sample.delayUs / 2 + 10, TrueOffsetUs, answer.sample.offsetUs);
+  TEST_ASSERT_EQUAL_UINT8(2, answer.stratum);
+  TEST_ASSERT_EQUAL_UINT8(SntpLeapNone, answer.leap);
+  TEST_ASSERT_INT64_WITHIN(50, Upstream.rootDelayUs, answer.rootDelayUs);
+  TEST_ASSERT_GREATER_THAN(Upstream.rootDispersionUs, answer.rootDispersionUs);
+  // Precision 2^-20 s of the server, 1 us of ours
+  TEST_ASSERT_GREATER_OR_EQUAL(1, answer.sample.dispersionUs);
+  TEST_ASSERT_LESS_THAN(10, answer.sample.dispersionUs);
+
+  // Asymmetric path: off by half the extra delay, but still within half the round trip
+  TEST_ASSERT_TRUE(poll(servers[AsymmetricServer], Upstream, answer));
+  TEST_ASSERT_GREATER_OR_EQUAL(20000, answer.sample.delayUs);
+  TEST_ASSERT_INT64_WITHIN(2000, TrueOffsetUs + 10000, answer.sample.offsetUs);
+  TEST_ASSERT_INT64_WITHIN(answer.sample.delayUs / 2 + 10, TrueOffsetUs, answer.sample.offsetUs);
+}
+
+static void testRejectedAnswers()
+{
+  const SntpUpstream none = {0, 0, 0, 0};
+  uint8_t request[NtpPacketBytes];
+  uint8_t packet[NtpPacketBytes];
+  NtpRequest sent;
+  NtpAnswer answer;
+  const int64_t nowUs = 1719792000000000LL;
+
+  // Not synchronized itself: leap indicator 3, stratum 16
+  TEST_ASSERT_FALSE(poll(servers[0], none, answer));
+
+  // A valid answer, then one field at a time broken
+  buildNtpRequest(request, nowUs, sent);
+  memcpy(packet, request, sizeof(packet));
+  buildSntpAnswer(packet, Upstream, SntpLeapNone, nowUs - 60000000, nowUs + 100, 60000000);
+  stampSntpAnswer(packet, nowUs + 120);
+  memcpy(request, packet, sizeof(packet));
+  TEST_ASSERT_TRUE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+  TEST_ASSERT_INT64_WITHIN(1, 10, answer.sample.offsetUs);
+  TEST_ASSERT_INT64_WITHIN(1, 180, answer.sample.delayUs);
+
+  // Truncated
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet) - 1, sent, nowUs + 200, 1000000, answer));
+
+  // Client or broadcast mode
+  packet[0] = (packet[0] & ~7) | 3;
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+  packet[0] = (packet[0] & ~7) | 5;
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+  memcpy(packet, request, sizeof(packet));
+
+  // Kiss-o'-death (stratum 0) and beyond stratum 15
+  packet[1] = 0;
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+  packet[1] = 16;
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+  memcpy(packet, request, sizeof(packet));
+
+  // Not an answer to this request (another originate timestamp)
+  packet[31] ^= 1;
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+  memcpy(packet, request, sizeof(packet));
+
+  // No transmit timestamp
+  memset(packet + 40, 0, 4);
+  TEST_ASSERT_FALSE(parseNtpAnswer(packet, sizeof(packet), sent, nowUs + 200, 1000000, answer));
+}
+
+static void testSelection()
+{
+  NtpPeer peers[ServerCount];
+  NtpSelection selection;
+  NtpAnswer answer;
+
+  for (uint8_t n = 0; n < ServerCount; n++)
+    clearNtpPeer(peers[n]);
+
+  // Fill the clock filters as the client does
+  for (uint8_t poll_ = 0; poll_ < NtpFilterStages; poll_++)
+    for (uint8_t n = 0; n < ServerCount; n++)
+    {
+      TEST_ASSERT_TRUE(poll(servers[n], Upstream, answer));
+
+      NtpPeer &peer = peers[n];
+      peer.stratum = answer.stratum;
+      peer.leap = answer.leap;
+      peer.rootDelayUs = answer.rootDelayUs;
+      peer.rootDispersionUs = answer.rootDispersionUs;
+      addNtpSample(peer, answer.sample, monotonicUs());
+    }
+
+  TEST_ASSERT_TRUE(selectNtpPeers(peers, ServerCount, monotonicUs(), &selection));
+
+  // The skewed server is a falseticker, the asymmetric one agrees but is the first the cluster algorithm drops
+  TEST_ASSERT_FALSE(selection.survivors[SkewedServer]);
+  TEST_ASSERT_FALSE(selection.survivors[AsymmetricServer]);
+  TEST_ASSERT_EQUAL_UINT8(NtpMinClusterSurvivors, selection.survivorCount);
+  TEST_ASSERT_TRUE(selection.systemPeer >= 0 && selection.systemPeer < SkewedServer);
+  TEST_ASSERT_INT64_WITHIN(300, TrueOffsetUs, selection.offsetUs);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testRequest);
+  RUN_TEST(testOffsetAndDelay);
+  RUN_TEST(testRejectedAnswers);
+  RUN_TEST(testSelection);
+  return UNITY_END();
+}
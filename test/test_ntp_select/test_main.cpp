@@ -0,0 +1,185 @@
+#include <unity.h>
+
+#include <math.h>
+
+#include "ntp_select.h"
+
+/**
+ * Clock filter, intersection, cluster and combine algorithms against peers with made up samples.
+ */
+
+// Local monotonic time of the newest samples
+static const uint64_t NowUs = 1000000000ULL;
+
+/**
+ * A peer with a full clock filter, all samples with the same offset (no jitter), delay and dispersion.
+ */
+static void fillPeer(NtpPeer &peer, int64_t offsetUs, int64_t delayUs, uint8_t stratum)
+{
+  clearNtpPeer(peer);
+  peer.stratum = stratum;
+
+  for (uint8_t n = 0; n < NtpFilterStages; n++)
+  {
+    const NtpSample sample = {offsetUs, delayUs, 100, NowUs - (NtpFilterStages - 1 - n) * 16000000ULL, true};
+    addNtpSample(peer, sample, sample.timeUs);
+  }
+}
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void testClockFilter()
+{
+  NtpPeer peer;
+
+  clearNtpPeer(peer);
+  TEST_ASSERT_FALSE(peer.valid);
+
+  // Offset and delay of the sample with the least delay, not the newest one
+  const int64_t offsets[] = {300, -200, 120, 900, 150, 80, 400, 100};
+  const int64_t delays[] = {9000, 12000, 4000, 30000, 8000, 7000, 15000, 6000};
+  for (uint8_t n = 0; n < NtpFilterStages; n++)
+  {
+    const NtpSample sample = {offsets[n], delays[n], 50, NowUs + n * 1000000ULL, true};
+    addNtpSample(peer, sample, sample.timeUs);
+  }
+
+  TEST_ASSERT_TRUE(peer.valid);
+  TEST_ASSERT_EQUAL_INT64(120, peer.offsetUs);
+  TEST_ASSERT_EQUAL_INT64(4000, peer.delayUs);
+  TEST_ASSERT_EQUAL_UINT64(NowUs + 2000000ULL, peer.updateUs);
+
+  // Jitter: RMS of the other offsets from the selected one, by delay 100, 80, 150, 300, 400, -200, 900
+  const double squares = 20.0 * 20 + 40 * 40 + 30 * 30 + 180 * 180 + 280 * 280 + 320 * 320 + 780 * 780;
+  TEST_ASSERT_INT64_WITHIN(1, (int64_t)sqrt(squares / 7), peer.jitterUs);
+
+  // A full filter weighs the dispersion of its stages down to almost one sample's
+  TEST_ASSERT_GREATER_THAN(50, peer.dispersionUs);
+  TEST_ASSERT_LESS_THAN(100, peer.dispersionUs);
+
+  // The samples move with a clock step
+  shiftNtpPeer(peer, 100);
+  TEST_ASSERT_EQUAL_INT64(20, peer.offsetUs);
+  TEST_ASSERT_EQUAL_INT64(0, peer.samples[0].offsetUs);
+  TEST_ASSERT_EQUAL_INT64(200, peer.samples[NtpFilterStages - 1].offsetUs);
+}
+
+static void testAgedSamples()
+{
+  NtpPeer peer;
+  const NtpSample sample = {500, 10000, 100, NowUs, true};
+
+  clearNtpPeer(peer);
+  addNtpSample(peer, sample, NowUs);
+  TEST_ASSERT_TRUE(peer.valid);
+
+  // A single sample leaves the other stages at MAXDISP, too far for a selection
+  TEST_ASSERT_GREATER_OR_EQUAL(NtpMaxDistanceUs, ntpRootDistance(peer, NowUs));
+
+  // A sample whose dispersion grew beyond MAXDISP (PHI over about 12 days) is not taken any more
+  const uint64_t later = NowUs + (uint64_t)NtpMaxDispersionUs * 1000000 / NtpPhiPpm;
+  const NtpSample invalid = {0, 0, 0, 0, false};
+  addNtpSample(peer, invalid, later);
+  TEST_ASSERT_FALSE(peer.valid);
+}
+
+static void testIntersection()
+{
+  NtpPeer peers[5];
+  NtpSelection selection;
+
+  // Three truechimers around 1 ms and two falsetickers, far off in both directions
+  fillPeer(peers[0], 1000, 10000, 2);
+  fillPeer(peers[1], 50000, 10000, 1);
+  fillPeer(peers[2], 1300, 12000, 2);
+  fillPeer(peers[3], -80000, 8000, 1);
+  fillPeer(peers[4], 900, 9000, 2);
+
+  TEST_ASSERT_TRUE(selectNtpPeers(peers, 5, NowUs, &selection));
+  TEST_ASSERT_EQUAL_UINT8(3, selection.survivorCount);
+  TEST_ASSERT_TRUE(selection.survivors[0]);
+  TEST_ASSERT_FALSE(selection.survivors[1]);
+  TEST_ASSERT_TRUE(selection.survivors[2]);
+  TEST_ASSERT_FALSE(selection.survivors[3]);
+  TEST_ASSERT_TRUE(selection.survivors[4]);
+  TEST_ASSERT_INT64_WITHIN(200, 1050, selection.offsetUs);
+  // Not one of the falsetickers, even with their lower stratum
+  TEST_ASSERT_TRUE(selection.systemPeer == 0 || selection.systemPeer == 2 || selection.systemPeer == 4);
+
+  // A peer too far away (single sample) is no candidate
+  clearNtpPeer(peers[1]);
+  const NtpSample sample = {1000, 10000, 100, NowUs, true};
+  addNtpSample(peers[1], sample, NowUs);
+  TEST_ASSERT_TRUE(selectNtpPeers(peers, 5, NowUs, &selection));
+  TEST_ASSERT_FALSE(selection.survivors[1]);
+}
+
+static void testNoMajority()
+{
+  NtpPeer peers[4];
+  NtpSelection selection;
+
+  // Two against two
+  fillPeer(peers[0], 1000, 10000, 2);
+  fillPeer(peers[1], 60000, 10000, 2);
+  TEST_ASSERT_FALSE(selectNtpPeers(peers, 2, NowUs, &selection));
+  TEST_ASSERT_EQUAL_INT8(-1, selection.systemPeer);
+
+  fillPeer(peers[2], 1200, 10000, 2);
+  fillPeer(peers[3], 61000, 10000, 2);
+  TEST_ASSERT_FALSE(selectNtpPeers(peers, 4, NowUs, &selection));
+
+  // No valid peer at all
+  clearNtpPeer(peers[0]);
+  TEST_ASSERT_FALSE(selectNtpPeers(peers, 1, NowUs, &selection));
+}
+
+static void testClusterAndCombine()
+{
+  NtpPeer peers[5];
+  NtpSelection selection;
+
+  // All intervals overlap (100 ms delay), the cluster algorithm drops the ones farthest from the rest down to
+  // NtpMinClusterSurvivors: first 3000, then 0
+  fillPeer(peers[0], 0, 100000, 2);
+  fillPeer(peers[1], 100, 100000, 2);
+  fillPeer(peers[2], 150, 100000, 1);
+  fillPeer(peers[3], 200, 100000, 2);
+  fillPeer(peers[4], 3000, 100000, 2);
+
+  TEST_ASSERT_TRUE(selectNtpPeers(peers, 5, NowUs, &selection));
+  TEST_ASSERT_EQUAL_UINT8(NtpMinClusterSurvivors, selection.survivorCount);
+  TEST_ASSERT_FALSE(selection.survivors[0]);
+  TEST_ASSERT_TRUE(selection.survivors[1]);
+  TEST_ASSERT_TRUE(selection.survivors[2]);
+  TEST_ASSERT_TRUE(selection.survivors[3]);
+  TEST_ASSERT_FALSE(selection.survivors[4]);
+
+  // Equal distances: the plain mean; the system peer has the least stratum
+  TEST_ASSERT_INT64_WITHIN(1, 150, selection.offsetUs);
+  TEST_ASSERT_EQUAL_INT8(2, selection.systemPeer);
+  TEST_ASSERT_INT64_WITHIN(1, 40, selection.jitterUs);
+
+  // Closer peers weigh more
+  fillPeer(peers[1], 100, 10000, 2);
+  fillPeer(peers[3], 200, 100000, 2);
+  TEST_ASSERT_TRUE(selectNtpPeers(peers, 4, NowUs, &selection));
+  TEST_ASSERT_LESS_THAN(150, selection.offsetUs);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testClockFilter);
+  RUN_TEST(testAgedSamples);
+  RUN_TEST(testIntersection);
+  RUN_TEST(testNoMajority);
+  RUN_TEST(testClusterAndCombine);
+  return UNITY_END();
+}
@@ -0,0 +1,160 @@
+#include <unity.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include "sntp_packet.h"
+#include "ntp_select.h"
+
+/**
+ * Request parsing and answers of the SNTP server, and how many requests a second the path from the received
+ * request to the stamped answer takes (without the UDP stack).
+ */
+
+#define BenchmarkRequests 2000000UL
+
+// 2024-07-01 00:00:00 UTC
+static const int64_t ReferenceUs = 1719792000000000LL;
+// 192.168.1.10, first octet in the low byte
+static const uint32_t UpstreamAddress = 192 | 168 << 8 | 1 << 16 | 10UL << 24;
+
+static uint8_t request[SntpPacketBytes];
+
+static uint32_t getUint32(const uint8_t *in)
+{
+  return (uint32_t)in[0] << 24 | (uint32_t)in[1] << 16 | (uint32_t)in[2] << 8 | in[3];
+}
+
+static int64_t getTimestampUs(const uint8_t *in)
+{
+  return ((int64_t)getUint32(in) - NtpUnixOffset) * 1000000LL + (int64_t)(((uint64_t)getUint32(in + 4) * 1000000) >> 32);
+}
+
+void setUp()
+{
+  // Client, version 4, poll 2^6, transmit timestamp of the client
+  memset(request, 0, sizeof(request));
+  request[0] = 4 << 3 | 3;
+  request[2] = 6;
+  for (uint8_t n = 0; n < 8; n++)
+    request[40 + n] = 0xA0 + n;
+}
+
+void tearDown()
+{
+}
+
+static void testRequests()
+{
+  uint8_t packet[SntpPacketBytes + 4];
+
+  memcpy(packet, request, sizeof(request));
+  TEST_ASSERT_TRUE(sntpClientRequest(packet, SntpPacketBytes));
+  TEST_ASSERT_TRUE(sntpClientRequest(packet, SntpPacketBytes + 4));
+  TEST_ASSERT_FALSE(sntpClientRequest(packet, SntpPacketBytes - 1));
+
+  // Server answers, broadcasts and symmetric modes are no requests
+  packet[0] = 4 << 3 | 4;
+  TEST_ASSERT_FALSE(sntpClientRequest(packet, SntpPacketBytes));
+  packet[0] = 4 << 3 | 5;
+  TEST_ASSERT_FALSE(sntpClientRequest(packet, SntpPacketBytes));
+  packet[0] = 4 << 3 | 1;
+  TEST_ASSERT_FALSE(sntpClientRequest(packet, SntpPacketBytes));
+}
+
+static void testSynchronized()
+{
+  const SntpUpstream upstream = {2, UpstreamAddress, 15000, 20000};
+  const int64_t receivedUs = ReferenceUs + 64000123;
+  uint8_t packet[SntpPacketBytes];
+  const uint8_t refid[4] = {192, 168, 1, 10};
+
+  memcpy(packet, request, sizeof(packet));
+  buildSntpAnswer(packet, upstream, SntpLeapInsert, ReferenceUs, receivedUs, 64000000);
+  stampSntpAnswer(packet, receivedUs + 35);
+
+  // Leap indicator, version of the request, server mode
+  TEST_ASSERT_EQUAL_UINT8(SntpLeapInsert << 6 | 4 << 3 | 4, packet[0]);
+  // One below the upstream server, poll interval copied
+  TEST_ASSERT_EQUAL_UINT8(3, packet[1]);
+  TEST_ASSERT_EQUAL_UINT8(6, packet[2]);
+  TEST_ASSERT_EQUAL_INT8(SntpPrecision, (int8_t)packet[3]);
+
+  // Root delay of the upstream server, root dispersion grown by the drift since the sync
+  TEST_ASSERT_EQUAL_UINT32(15000 * 65536 / 1000000, getUint32(packet + 4));
+  TEST_ASSERT_EQUAL_UINT32((20000 + SntpDispersionUs + 64 * SntpDriftPpm) * 65536 / 1000000, getUint32(packet + 8));
+
+  // The reference id is the IPv4 address of the upstream server
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(refid, packet + 12, 4);
+
+  TEST_ASSERT_INT64_WITHIN(1, ReferenceUs, getTimestampUs(packet + 16));
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(request + 40, packet + 24, 8);
+  TEST_ASSERT_INT64_WITHIN(1, receivedUs, getTimestampUs(packet + 32));
+  TEST_ASSERT_INT64_WITHIN(1, receivedUs + 35, getTimestampUs(packet + 40));
+}
+
+static void testUnsynchronized()
+{
+  uint8_t packet[SntpPacketBytes];
+  const SntpUpstream none = {0, 0, 0, 0};
+  // Stratum 15 upstream, we would be 16
+  const SntpUpstream deepest = {15, UpstreamAddress, 0, 0};
+  const SntpUpstream *upstreams[] = {&none, &deepest};
+
+  for (uint8_t n = 0; n < 2; n++)
+  {
+    memcpy(packet, request, sizeof(packet));
+    buildSntpAnswer(packet, *upstreams[n], SntpLeapNone, ReferenceUs, ReferenceUs, 0);
+
+    TEST_ASSERT_EQUAL_UINT8(SntpLeapUnsynchronized << 6 | 4 << 3 | 4, packet[0]);
+    TEST_ASSERT_EQUAL_UINT8(16, packet[1]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY((const uint8_t *)SntpKissCode, packet + 12, 4);
+    TEST_ASSERT_EQUAL_UINT32(0, getUint32(packet + 16));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(request + 40, packet + 24, 8);
+  }
+}
+
+static void testThroughput()
+{
+  const SntpUpstream upstream = {2, UpstreamAddress, 15000, 20000};
+  uint8_t packet[SntpPacketBytes];
+  uint32_t answered = 0;
+  uint32_t check = 0;
+  char message[96];
+
+  const auto start = std::chrono::steady_clock::now();
+  for (uint32_t n = 0; n < BenchmarkRequests; n++)
+  {
+    const int64_t receivedUs = ReferenceUs + n;
+
+    memcpy(packet, request, sizeof(packet));
+    packet[47] = n;
+    if (!sntpClientRequest(packet, sizeof(packet)))
+      continue;
+    buildSntpAnswer(packet, upstream, SntpLeapNone, ReferenceUs, receivedUs, n);
+    stampSntpAnswer(packet, receivedUs + 1);
+    answered++;
+    check += packet[31] ^ packet[47];
+  }
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  const double qps = answered / elapsed.count();
+  snprintf(message, sizeof(message), "%u answers in %.3f s: %.0f requests/s, %.1f ns per request (check %u)", answered,
+           elapsed.count(), qps, elapsed.count() * 1e9 / answered, check);
+  TEST_MESSAGE(message);
+
+  TEST_ASSERT_EQUAL_UINT32(BenchmarkRequests, answered);
+  // Far beyond what the radio of an ESP8266 carries, the answer path must never be the bottleneck
+  TEST_ASSERT_GREATER_THAN(100000, (uint32_t)qps);
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testRequests);
+  RUN_TEST(testSynchronized);
+  RUN_TEST(testUnsynchronized);
+  RUN_TEST(testThroughput);
+  return UNITY_END();
+}
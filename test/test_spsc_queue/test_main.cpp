@@ -0,0 +1,108 @@
+#include <unity.h>
+
+#include <thread>
+
+#include "spsc_queue.h"
+
+/**
+ * Stress test of the transmission queue: a producer and a consumer thread hand over slots as fast as they can, the
+ * consumer must see every slot complete and in order. The slots are larger than a cache line so a torn slot would
+ * show up as a mismatch between its words.
+ */
+
+#define StressSlots 2000000UL
+#define SlotWords 32
+
+struct StressSlot
+{
+  uint32_t sequence;
+  uint32_t words[SlotWords];
+};
+
+static SpscQueue<StressSlot, 4> queue;
+
+void setUp()
+{
+}
+
+void tearDown()
+{
+}
+
+static void produce()
+{
+  for (uint32_t sequence = 0; sequence < StressSlots; sequence++)
+  {
+    StressSlot *slot;
+    while (!(slot = queue.reserve()))
+      std::this_thread::yield();
+
+    slot->sequence = sequence;
+    for (uint32_t n = 0; n < SlotWords; n++)
+      slot->words[n] = sequence * SlotWords + n;
+    queue.commit();
+  }
+}
+
+static void testFillAndDrain()
+{
+  SpscQueue<uint32_t, 4> small;
+
+  TEST_ASSERT_TRUE(small.empty());
+  TEST_ASSERT_NULL(small.front());
+
+  for (uint32_t n = 0; n < 4; n++)
+  {
+    uint32_t *slot = small.reserve();
+    TEST_ASSERT_NOT_NULL(slot);
+    *slot = n;
+    small.commit();
+  }
+  TEST_ASSERT_NULL(small.reserve());
+
+  for (uint32_t n = 0; n < 4; n++)
+  {
+    TEST_ASSERT_EQUAL_UINT32(n, *small.front());
+    small.pop();
+  }
+  TEST_ASSERT_TRUE(small.empty());
+}
+
+static void testTwoThreads()
+{
+  uint32_t torn = 0;
+  uint32_t reordered = 0;
+
+  std::thread producer(produce);
+
+  for (uint32_t expected = 0; expected < StressSlots; expected++)
+  {
+    const StressSlot *slot;
+    while (!(slot = queue.front()))
+      std::this_thread::yield();
+
+    if (slot->sequence != expected)
+      reordered++;
+    for (uint32_t n = 0; n < SlotWords; n++)
+      if (slot->words[n] != slot->sequence * SlotWords + n)
+      {
+        torn++;
+        break;
+      }
+    queue.pop();
+  }
+
+  producer.join();
+
+  TEST_ASSERT_EQUAL_UINT32(0, reordered);
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_TRUE(queue.empty());
+}
+
+int main()
+{
+  UNITY_BEGIN();
+  RUN_TEST(testFillAndDrain);
+  RUN_TEST(testTwoThreads);
+  return UNITY_END();
+}